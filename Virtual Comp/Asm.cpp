@@ -0,0 +1,486 @@
+#include "Asm.h"
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <unordered_map>
+#include "Format.h"
+#include "Ops.h"
+
+namespace {
+
+// Mnemonics are at most 8 characters, so each one packs into a single
+// integer and the lookup is a switch rather than a string hash.
+constexpr uint64_t key(std::string_view s) {
+    uint64_t k = 0;
+    for (size_t i = 0; i < s.size() && i < 8; ++i) k |= uint64_t(uint8_t(s[i])) << (8 * i);
+    return k;
+}
+
+int opcodeOf(std::string_view t) {
+    if (t.size() > 8) return -1;
+    switch (key(t)) {
+        case key("PUSH"):    return OP_PUSH;
+        case key("MOV"):     return OP_MOV;
+        case key("ADDR"):    return OP_ADDR;
+        case key("SUBR"):    return OP_SUBR;
+        case key("LOADR"):   return OP_LOADR;
+        case key("STORER"):  return OP_STORER;
+        case key("PRINT"):   return OP_PRINT;
+        case key("PRINTR"):  return OP_PRINTR;
+        case key("CMP"):     return OP_CMP;
+        case key("JEQ"):     return OP_JEQ;
+        case key("JNE"):     return OP_JNE;
+        case key("JGT"):     return OP_JGT;
+        case key("JLT"):     return OP_JLT;
+        case key("LOADM"):   return OP_LOADM;
+        case key("STOREM"):  return OP_STOREM;
+        case key("LOADMR"):  return OP_LOADMR;
+        case key("STOREMR"): return OP_STOREMR;
+        case key("DECR"):    return OP_DECR;
+        case key("CPRINT"):  return OP_CPRINT;
+        case key("CEASE"):   return OP_CEASE;
+        case key("ADD"):     return OP_ADD;
+        case key("SUB"):     return OP_SUB;
+        case key("MUL"):     return OP_MUL;
+        case key("DUP"):     return OP_DUP;
+        case key("VADD"):    return OP_VADD;
+        case key("VFILL"):   return OP_VFILL;
+        case key("VCOPY"):   return OP_VCOPY;
+        case key("VSUM"):    return OP_VSUM;
+        case key("VCNT"):    return OP_VCNT;
+        case key("VMIN"):    return OP_VMIN;
+        case key("VMAX"):    return OP_VMAX;
+        case key("MULR"):    return OP_MULR;
+        case key("DIVR"):    return OP_DIVR;
+        case key("MODR"):    return OP_MODR;
+        case key("ANDR"):    return OP_ANDR;
+        case key("ORR"):     return OP_ORR;
+        case key("XORR"):    return OP_XORR;
+        case key("SHLR"):    return OP_SHLR;
+        case key("SHRR"):    return OP_SHRR;
+        case key("SARR"):    return OP_SARR;
+        case key("ADDI"):    return OP_ADDI;
+        case key("SUBI"):    return OP_SUBI;
+        case key("MULI"):    return OP_MULI;
+        case key("DIVI"):    return OP_DIVI;
+        case key("MODI"):    return OP_MODI;
+        case key("ANDI"):    return OP_ANDI;
+        case key("ORI"):     return OP_ORI;
+        case key("XORI"):    return OP_XORI;
+        case key("SHLI"):    return OP_SHLI;
+        case key("SHRI"):    return OP_SHRI;
+        case key("SARI"):    return OP_SARI;
+        case key("INC"):     return OP_INC;
+        case key("DEC"):     return OP_DEC;
+        case key("CMPI"):    return OP_CMPI;
+        case key("LOADC"):   return OP_LOAD;  // COUNTER = a
+        case key("LOAD"):    return OP_LOAD;  // as --disasm names it
+        case key("CALL"):    return OP_CALL;
+        case key("RET"):     return OP_RET;
+        default:             return -1;
+    }
+}
+
+bool isSpace(char c) { return c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f'; }
+bool isLabelStart(char c) { return (c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z') || c == '_' || c == '.'; }
+bool isLabelChar(char c) { return isLabelStart(c) || (c >= '0' && c <= '9'); }
+
+// A whole token as an integer with an optional sign: base 10, or base 16
+// after 0x. A hex constant is a bit pattern, so 0x80000000-0xFFFFFFFF are
+// taken as the negative values with those bits.
+bool parseInt(std::string_view t, int32_t& v) {
+    size_t i = (!t.empty() && (t[0] == '-' || t[0] == '+')) ? 1 : 0;
+    if (i == t.size()) return false;
+    const bool hex = t.size() - i > 2 && t[i] == '0' && (t[i + 1] == 'x' || t[i + 1] == 'X');
+    if (hex) i += 2;
+    const int64_t most = hex ? int64_t(UINT32_MAX) : int64_t(INT32_MAX) + 1;
+    int64_t x = 0;
+    for (; i < t.size(); ++i) {
+        int d;
+        if (t[i] >= '0' && t[i] <= '9') d = t[i] - '0';
+        else if (hex && t[i] >= 'a' && t[i] <= 'f') d = t[i] - 'a' + 10;
+        else if (hex && t[i] >= 'A' && t[i] <= 'F') d = t[i] - 'A' + 10;
+        else return false;
+        x = x * (hex ? 16 : 10) + d;
+        if (x > most) return false;
+    }
+    if (t[0] == '-') x = -x;
+    else if (hex && x > INT32_MAX) x = int32_t(uint32_t(x));
+    if (x > INT32_MAX || x < INT32_MIN) return false;
+    v = int32_t(x);
+    return true;
+}
+
+void append(std::vector<uint8_t>& out, const void* p, size_t n) {
+    const uint8_t* b = static_cast<const uint8_t*>(p);
+    out.insert(out.end(), b, b + n);
+}
+
+using Symbols = std::vector<std::pair<std::string_view, int>>;  // name, line; in definition order
+
+void writeContainer(std::vector<uint8_t>& out, const std::vector<CodeRecord>& code, const std::vector<int32_t>& data,
+                    const Symbols& symbols, uint32_t memoryCells, uint32_t flags) {
+    size_t symbolBytes = 0;
+    for (auto& s : symbols) symbolBytes += 2 * sizeof(uint32_t) + s.first.size();
+
+    ContainerHeader header{};
+    std::memcpy(header.magic, VMBC_MAGIC, sizeof(header.magic));
+    header.version = VMBC_VERSION;
+    header.headerSize = sizeof(header);
+    header.codeCount = (uint32_t)code.size();
+    header.dataCount = (uint32_t)data.size();
+    header.symbolsSize = (uint32_t)symbolBytes;
+    header.memoryCells = memoryCells;
+    header.flags = flags;
+
+    out.clear();
+    out.reserve(sizeof(header) + code.size() * sizeof(CodeRecord) + data.size() * sizeof(int32_t) + symbolBytes);
+    append(out, &header, sizeof(header));
+    append(out, code.data(), code.size() * sizeof(CodeRecord));
+    append(out, data.data(), data.size() * sizeof(int32_t));
+    for (auto& s : symbols) {
+        uint32_t entry[2] = {(uint32_t)s.second, (uint32_t)s.first.size()};
+        append(out, entry, sizeof(entry));
+        append(out, s.first.data(), s.first.size());
+    }
+}
+
+// The operand a label stands for. A jump resumes on the line after the
+// one its label names (jumps count lines from 1); a CALL enters the
+// subroutine at the labelled line itself.
+int32_t labelOperand(uint8_t opcode, int line) {
+    return opcode == OP_CALL ? line : line + 1;
+}
+
+} // namespace
+
+bool assemble(std::string_view source, std::vector<uint8_t>& out, std::string& error, AsmStats* stats) {
+    struct Fixup { size_t record; int slot; std::string_view name; size_t srcLine; };
+    std::unordered_map<std::string_view, int> labels;       // name -> 0-based line it labels
+    Symbols symbols;
+    std::vector<Fixup> fixups;
+    std::vector<CodeRecord> code;
+    std::vector<int32_t> data;
+    uint32_t memoryCells = 0;  // .memory; 0 leaves it to the VM
+    code.reserve(std::count(source.begin(), source.end(), '\n') + 1);  // at most one per line
+
+    size_t lineNo = 0;
+    auto fail = [&](const std::string& what) {
+        error = "line " + std::to_string(lineNo) + ": " + what;
+        return false;
+    };
+
+    const char* p = source.data();
+    const char* const end = p + source.size();
+    while (p < end) {
+        ++lineNo;
+        const char* eol = static_cast<const char*>(std::memchr(p, '\n', end - p));
+        if (!eol) eol = end;
+        const char* stop = static_cast<const char*>(std::memchr(p, ';', eol - p));
+        if (!stop) stop = eol;  // a comment runs to the end of the line
+        const char* q = p;
+        p = eol < end ? eol + 1 : end;
+
+        // `name:` at the start of a line labels the next instruction
+        while (q < stop && isSpace(*q)) ++q;
+        if (q < stop && isLabelStart(*q)) {
+            const char* n = q + 1;
+            while (n < stop && isLabelChar(*n)) ++n;
+            const char* c = n;
+            while (c < stop && isSpace(*c)) ++c;
+            if (c < stop && *c == ':') {
+                std::string_view name(q, n - q);
+                if (!labels.emplace(name, (int)code.size()).second)
+                    return fail("label '" + std::string(name) + "' is defined twice");
+                symbols.push_back({name, (int)code.size()});
+                q = c + 1;
+            }
+        }
+
+        // split the rest into at most four tokens; extras are ignored
+        std::string_view tok[4];
+        int ntok = 0;
+        while (q < stop && ntok < 4) {
+            while (q < stop && isSpace(*q)) ++q;
+            const char* t = q;
+            while (q < stop && !isSpace(*q)) ++q;
+            if (q > t) tok[ntok++] = std::string_view(t, q - t);
+        }
+        if (ntok == 0) continue;
+
+        if (tok[0] == ".data") {
+            // .data v1 v2 ... : initial memory, appended cell by cell
+            for (const char* d = tok[1].empty() ? stop : tok[1].data(); d < stop; ) {
+                while (d < stop && isSpace(*d)) ++d;
+                const char* t = d;
+                while (d < stop && !isSpace(*d)) ++d;
+                if (d == t) break;
+                int32_t v;
+                if (!parseInt(std::string_view(t, d - t), v))
+                    return fail("bad .data value '" + std::string(t, d - t) + "'");
+                data.push_back(v);
+            }
+            continue;
+        }
+        if (tok[0] == ".memory") {
+            // .memory N : the program needs N cells of memory
+            int32_t v;
+            if (ntok != 2 || !parseInt(tok[1], v) || v <= 0) return fail(".memory expects a positive cell count");
+            memoryCells = uint32_t(v);
+            continue;
+        }
+
+        int opcode = opcodeOf(tok[0]);
+        if (opcode < 0) return fail("unknown instruction '" + std::string(tok[0]) + "'");
+
+        CodeRecord rec{};
+        rec.opcode = uint8_t(opcode);
+        int32_t* slots[3] = {&rec.a, &rec.b, &rec.c};
+        for (int k = 1; k < ntok; ++k) {
+            std::string_view t = tok[k];
+            int32_t& v = *slots[k - 1];
+            if (t == "COUNTER") v = 0xFF;
+            else if (t.size() > 1 && t[0] == 'R' && parseInt(t.substr(1), v)) {}
+            else if (parseInt(t, v)) {}
+            else if (isLabelStart(t[0])) {
+                auto l = labels.find(t);
+                if (l != labels.end()) v = labelOperand(rec.opcode, l->second);
+                else fixups.push_back({code.size(), k - 1, t, lineNo});
+            } else {
+                return fail("unknown operand '" + std::string(t) + "' (not int/reg/label)");
+            }
+        }
+        code.push_back(rec);
+    }
+
+    // forward references
+    for (const Fixup& f : fixups) {
+        auto l = labels.find(f.name);
+        if (l == labels.end()) {
+            lineNo = f.srcLine;
+            return fail("unknown operand '" + std::string(f.name) + "' (not int/reg/label)");
+        }
+        int32_t* slots[3] = {&code[f.record].a, &code[f.record].b, &code[f.record].c};
+        *slots[f.slot] = labelOperand(code[f.record].opcode, l->second);
+    }
+
+    writeContainer(out, code, data, symbols, memoryCells, 0);
+
+    if (stats) {
+        stats->lines = lineNo;
+        stats->instructions = code.size();
+    }
+    return true;
+}
+
+// --- text mode ---
+// The dialect VirtualMachine::loadProgram() used to interpret line by line.
+// Line numbers are kept exactly: a jump to N resumes at source line N,
+// counting from 0, and `name:` alone on a line labels it. Label lines,
+// blank lines and lines that don't start with a known instruction compile
+// to nothing, so every target is mapped to the first instruction at or
+// after its line once the whole file has been read.
+
+namespace {
+
+// Every instruction text mode knows; the shared ones keep their bytecode
+// opcodes.
+int textOpcodeOf(std::string_view t) {
+    if (t.size() > 8) return -1;
+    switch (key(t)) {
+        case key("HOP"):     return OP_HOP;
+        case key("CEASE"):   return OP_CEASE;
+        case key("PUSH"):    return OP_PUSH;
+        case key("ADD"):     return OP_ADD;
+        case key("SUB"):     return OP_SUB;
+        case key("MUL"):     return OP_MUL;
+        case key("DUP"):     return OP_DUP;
+        case key("PRINT"):   return OP_PRINT;
+        case key("PKPRINT"): return OP_PRINT;  // PRINT never popped either
+        case key("HNZ"):     return OP_HNZ;
+        case key("HZ"):      return OP_HZ;
+        case key("LOAD"):    return OP_LOAD;
+        case key("DECR"):    return OP_DECR;
+        case key("CPRINT"):  return OP_CPRINT;
+        case key("CHNZ"):    return OP_CHNZ;
+        case key("STOREM"):  return OP_STOREM;
+        case key("LOADM"):   return OP_LOADM;
+        case key("SETM"):    return OP_SETM;
+        case key("MEMDUMP"): return OP_MEMDUMP;
+        case key("MOV"):     return OP_MOV;
+        case key("LOADR"):   return OP_LOADR;
+        case key("STORER"):  return OP_STORER;
+        case key("ADDR"):    return OP_ADDR;
+        case key("PRINTR"):  return OP_PRINTR;
+        case key("LOADMR"):  return OP_LOADMR;
+        case key("STOREMR"): return OP_STOREMR;
+        case key("CMP"):     return OP_CMP;
+        case key("JEQ"):     return OP_JEQ;
+        case key("JNE"):     return OP_JNE;
+        case key("JGT"):     return OP_JGT;
+        case key("JLT"):     return OP_JLT;
+        default:             return -1;
+    }
+}
+
+// What each operand of a text-mode instruction is.
+enum TextOperand : char { T_INT = 'i', T_REG = 'r', T_REG_OR_COUNTER = 'c', T_ADDR = 'a', T_TARGET = 't' };
+
+const char* textOperands(int opcode) {
+    switch (opcode) {
+        case OP_PUSH: case OP_LOAD:     return "i";
+        case OP_MOV:                    return "ri";
+        case OP_ADDR:                   return "rrr";
+        case OP_LOADR: case OP_STORER:
+        case OP_PRINTR:                 return "r";
+        case OP_CMP:                    return "cc";
+        case OP_LOADM: case OP_STOREM:  return "a";
+        case OP_SETM:                   return "ai";
+        case OP_LOADMR:                 return "ra";
+        case OP_STOREMR:                return "ar";
+        case OP_HOP: case OP_HZ: case OP_HNZ: case OP_CHNZ:
+        case OP_JEQ: case OP_JNE: case OP_JGT: case OP_JLT:
+                                        return "t";
+        default:                        return "";
+    }
+}
+
+} // namespace
+
+bool compileText(std::string_view source, std::vector<uint8_t>& out, std::string& error) {
+    struct Fixup { size_t record; std::string_view name; size_t srcLine; };
+    std::unordered_map<std::string_view, int> labels;  // name -> 0-based source line
+    Symbols symbols;                                   // name -> instruction it resumes at
+    std::vector<Fixup> fixups;
+    std::vector<int> firstAt;                          // source line -> first instruction at or after it
+    std::vector<CodeRecord> code;
+    int64_t highest = -1;                              // highest address used
+
+    size_t lineNo = 0;
+    auto fail = [&](const std::string& what) {
+        error = "line " + std::to_string(lineNo) + ": " + what;
+        return false;
+    };
+
+    const char* p = source.data();
+    const char* const end = p + source.size();
+    while (p < end) {
+        ++lineNo;
+        firstAt.push_back((int)code.size());
+        const char* eol = static_cast<const char*>(std::memchr(p, '\n', end - p));
+        if (!eol) eol = end;
+        const char* q = p;
+        p = eol < end ? eol + 1 : end;
+
+        // the mnemonic and up to three operands; anything after is ignored
+        std::string_view tok[4];
+        int ntok = 0;
+        while (q < eol && ntok < 4) {
+            while (q < eol && isSpace(*q)) ++q;
+            const char* t = q;
+            while (q < eol && !isSpace(*q)) ++q;
+            if (q > t) tok[ntok++] = std::string_view(t, q - t);
+        }
+        if (ntok == 0) continue;
+
+        if (tok[0].back() == ':') {
+            std::string_view name = tok[0].substr(0, tok[0].size() - 1);
+            if (!labels.emplace(name, (int)lineNo - 1).second)
+                return fail("label '" + std::string(name) + "' is defined twice");
+            symbols.push_back({name, (int)code.size()});
+            continue;
+        }
+        const int opcode = textOpcodeOf(tok[0]);
+        if (opcode < 0) continue;
+
+        CodeRecord rec{};
+        rec.opcode = uint8_t(opcode);
+        int32_t* slots[3] = {&rec.a, &rec.b, &rec.c};
+        const char* kinds = textOperands(opcode);
+        for (int k = 0; kinds[k]; ++k) {
+            std::string_view t = k + 1 < ntok ? tok[k + 1] : std::string_view();
+            if (t.empty()) return fail(std::string(tok[0]) + " is missing an operand");
+            int32_t& v = *slots[k];
+            switch (kinds[k]) {
+                case T_INT:
+                    if (!parseInt(t, v)) return fail("expected an integer, not '" + std::string(t) + "'");
+                    break;
+                case T_REG_OR_COUNTER:
+                    if (t == "COUNTER") { v = 0xFF; break; }
+                    [[fallthrough]];
+                case T_REG:
+                    if (t.size() != 2 || t[0] != 'R' || t[1] < '0' || t[1] > '7')
+                        return fail("invalid register '" + std::string(t) + "'");
+                    v = t[1] - '0';
+                    break;
+                case T_ADDR:
+                    if (!parseInt(t, v) || v < 0) return fail("invalid memory address '" + std::string(t) + "'");
+                    highest = std::max<int64_t>(highest, v);
+                    break;
+                case T_TARGET:
+                    if (parseInt(t, v)) {
+                        if (v < 0) return fail("jump target " + std::string(t) + " is negative");
+                        fixups.push_back({code.size(), std::string_view(), lineNo});
+                    } else {
+                        fixups.push_back({code.size(), t, lineNo});
+                    }
+                    break;
+            }
+        }
+        code.push_back(rec);
+    }
+
+    // targets are source lines until every line has been seen
+    for (const Fixup& f : fixups) {
+        int32_t& target = code[f.record].a;
+        if (!f.name.empty()) {
+            auto l = labels.find(f.name);
+            if (l == labels.end()) {
+                lineNo = f.srcLine;
+                return fail("unknown label '" + std::string(f.name) + "'");
+            }
+            target = l->second;
+        }
+        target = size_t(target) < firstAt.size() ? firstAt[target] : (int32_t)code.size();
+    }
+
+    writeContainer(out, code, {}, symbols, uint32_t(highest + 1), VMBC_FLAG_TEXT);
+    return true;
+}
+
+bool readSource(const std::string& path, std::string& source, std::string& error) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in) {
+        error = "Could not open " + path;
+        return false;
+    }
+    // bulk reads; works for pipes as well as regular files
+    const size_t chunk = 1 << 20;
+    source.clear();
+    for (;;) {
+        size_t have = source.size();
+        source.resize(have + chunk);
+        size_t got = (size_t)in.rdbuf()->sgetn(&source[have], chunk);
+        source.resize(have + got);
+        if (got < chunk) break;
+    }
+    return true;
+}
+
+bool assembleFile(const std::string& inPath, const std::string& outPath, std::string& error, AsmStats* stats) {
+    std::string source;
+    if (!readSource(inPath, source, error)) return false;
+
+    std::vector<uint8_t> bytes;
+    if (!assemble(source, bytes, error, stats)) {
+        error = inPath + ": " + error;
+        return false;
+    }
+
+    std::ofstream out(outPath, std::ios::binary);
+    if (!out || !out.write(reinterpret_cast<const char*>(bytes.data()), bytes.size())) {
+        error = "Could not write " + outPath;
+        return false;
+    }
+    return true;
+}
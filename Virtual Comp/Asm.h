@@ -0,0 +1,35 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// What one assemble() call went through.
+struct AsmStats {
+    size_t lines = 0;         // source lines, including blank and comment lines
+    size_t instructions = 0;  // code records written
+};
+
+// Assembles source text into a bytecode container (see Format.h), entirely
+// in memory. One pass over the source: labels may be used before they are
+// defined and are patched in once the whole file has been read. Returns
+// false on the first error, with `error` set to "line N: what".
+bool assemble(std::string_view source, std::vector<uint8_t>& out, std::string& error,
+              AsmStats* stats = nullptr);
+
+// Compiles a text-mode program (see VirtualMachine::loadProgram) into a
+// container flagged VMBC_FLAG_TEXT. A jump operand is a source line,
+// counting from 0, or a label defined as `name:` on a line of its own.
+// Lines that don't start with an instruction are skipped, as the text
+// interpreter always skipped them. Returns false on the first bad operand
+// or undefined label, with `error` set to "line N: what".
+bool compileText(std::string_view source, std::vector<uint8_t>& out, std::string& error);
+
+// Reads a whole source file into `source`.
+bool readSource(const std::string& path, std::string& source, std::string& error);
+
+// Reads `inPath`, assembles it and writes the container to `outPath` in one
+// write. Errors are prefixed with the input path.
+bool assembleFile(const std::string& inPath, const std::string& outPath, std::string& error,
+                  AsmStats* stats = nullptr);
@@ -0,0 +1,97 @@
+#include "AsmCache.h"
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <vector>
+#include "Asm.h"
+#include "Format.h"
+
+// 64-bit FNV-1a over 8-byte words, seeded with the container version so
+// entries from an older format are never picked up.
+static uint64_t hashSource(std::string_view s) {
+    const uint64_t prime = 0x100000001b3ull;
+    uint64_t h = 0xcbf29ce484222325ull ^ VMBC_VERSION;
+    size_t i = 0;
+    for (; i + 8 <= s.size(); i += 8) {
+        uint64_t w;
+        std::memcpy(&w, s.data() + i, 8);
+        h = (h ^ w) * prime;
+    }
+    for (; i < s.size(); ++i) h = (h ^ uint8_t(s[i])) * prime;
+    return (h ^ s.size()) * prime;
+}
+
+AssemblyCache::AssemblyCache(std::string dir) : dir(std::move(dir)) {}
+
+std::shared_ptr<const Program> AssemblyCache::get(std::string_view source, const std::string& name,
+                                                  std::string* error) {
+    const uint64_t key = hashSource(source);
+    {
+        std::lock_guard<std::mutex> lock(m);
+        auto it = entries.find(key);
+        if (it != entries.end() && it->second.source == source) {
+            ++counts.hits;
+            return it->second.program;
+        }
+    }
+
+    // assemble (or load from disk) outside the lock; two threads missing
+    // on the same source may both do the work, and one copy wins
+    std::string path;
+    if (!dir.empty()) {
+        char file[32];
+        std::snprintf(file, sizeof(file), "%016llx.vmbc", (unsigned long long)key);
+        path = dir + "/" + file;
+    }
+
+    std::shared_ptr<const Program> program;
+    bool fromDisk = false;
+    if (!path.empty() && std::ifstream(path)) {
+        std::string ignored;
+        program = Program::load(path, &ignored);  // a bad entry is just reassembled
+        fromDisk = program != nullptr;
+    }
+    if (!program) {
+        std::vector<uint8_t> bytes;
+        std::string why;
+        if (!assemble(source, bytes, why)) {
+            if (error) *error = name + ": " + why;
+            else std::cerr << name << ": " << why << "\n";
+            return nullptr;
+        }
+        program = Program::fromMemory(bytes.data(), bytes.size(), name, error);
+        if (!program) return nullptr;
+        if (!path.empty()) {
+            // write under a private name, then rename, so a reader never
+            // sees half an entry
+            std::string tmp = path + "." + std::to_string(std::random_device{}()) + ".tmp";
+            std::ofstream out(tmp, std::ios::binary);
+            out.write(reinterpret_cast<const char*>(bytes.data()), bytes.size());
+            out.close();
+            if (!out || std::rename(tmp.c_str(), path.c_str()) != 0) std::remove(tmp.c_str());
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(m);
+    ++(fromDisk ? counts.diskHits : counts.misses);
+    Entry& e = entries[key];
+    e.source.assign(source.data(), source.size());
+    e.program = program;
+    return program;
+}
+
+AssemblyCache::Stats AssemblyCache::stats() const {
+    std::lock_guard<std::mutex> lock(m);
+    return counts;
+}
+
+void AssemblyCache::printStats(std::ostream& os) const {
+    Stats s = stats();
+    os << "[CACHE] " << s.hits << " hit(s), " << s.diskHits << " disk hit(s), " << s.misses << " miss(es)\n";
+}
+
+bool isAssemblySource(const std::string& path) {
+    return path.size() > 4 && path.compare(path.size() - 4, 4, ".asm") == 0;
+}
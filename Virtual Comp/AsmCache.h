@@ -0,0 +1,50 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <iosfwd>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include "Program.h"
+
+// Assembles source text in-process and keeps the result, keyed by a hash
+// of the source. The same source submitted again, by any thread, reuses
+// the already decoded Program and skips assembly and validation
+// entirely. With a directory, assembled containers are also kept on disk
+// as <hash>.vmbc, so a later process skips assembly (the container is
+// still validated and decoded when it is loaded).
+class AssemblyCache {
+public:
+    struct Stats {
+        uint64_t hits = 0;      // served from memory
+        uint64_t diskHits = 0;  // loaded from the cache directory
+        uint64_t misses = 0;    // assembled
+    };
+
+    explicit AssemblyCache(std::string dir = "");  // empty: memory only
+
+    // Returns the program for `source`; null if it doesn't assemble or
+    // decode, with the reason in *error (or on std::cerr when error is
+    // null, as Program::load does). `name` is used in messages.
+    std::shared_ptr<const Program> get(std::string_view source, const std::string& name = "<source>",
+                                       std::string* error = nullptr);
+
+    Stats stats() const;
+    void printStats(std::ostream& os) const;
+
+private:
+    struct Entry {
+        std::string source;  // to confirm a hash match
+        std::shared_ptr<const Program> program;
+    };
+
+    std::string dir;
+    mutable std::mutex m;
+    std::unordered_map<uint64_t, Entry> entries;
+    Stats counts;
+};
+
+// True for paths the VM should assemble rather than load as bytecode.
+bool isAssemblySource(const std::string& path);
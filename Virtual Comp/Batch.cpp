@@ -0,0 +1,162 @@
+#include "Batch.h"
+#include "Asm.h"
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <thread>
+
+bool readManifest(const std::string& path, std::vector<BatchJob>& jobs, std::string& error) {
+    std::ifstream file(path);
+    if (!file) {
+        error = "Could not open manifest " + path;
+        return false;
+    }
+
+    const std::filesystem::path dir = std::filesystem::path(path).parent_path();
+    auto resolve = [&](const std::string& p) {
+        std::filesystem::path fp(p);
+        return fp.is_absolute() ? p : (dir / fp).string();
+    };
+
+    std::string line;
+    for (int n = 1; std::getline(file, line); ++n) {
+        std::istringstream iss(line);
+        std::string program, image, extra;
+        if (!(iss >> program) || program[0] == '#') continue;
+        iss >> image;
+        if (iss >> extra) {
+            error = path + ":" + std::to_string(n) + ": expected `program.bin [memory.img]`";
+            return false;
+        }
+        jobs.push_back({resolve(program), image.empty() ? image : resolve(image)});
+    }
+    return true;
+}
+
+bool readMemoryImage(const std::string& path, std::vector<int>& cells, std::string& error) {
+    std::ifstream file(path);
+    if (!file) {
+        error = "Could not open memory image " + path;
+        return false;
+    }
+    cells.clear();
+    int v;
+    while (file >> v) cells.push_back(v);
+    if (!file.eof()) {
+        error = "Invalid memory image " + path + ": cell " + std::to_string(cells.size()) + " is not an integer";
+        return false;
+    }
+    return true;
+}
+
+// Loads each distinct program once; every job running it shares the
+// decoded Program. Two workers that miss on the same file at once may
+// both load it, and one copy wins.
+class ProgramCache {
+public:
+    explicit ProgramCache(AssemblyCache& sources) : sources(sources) {}
+
+    std::shared_ptr<const Program> get(const std::string& path, std::string& error) {
+        {
+            std::lock_guard<std::mutex> lock(m);
+            auto it = entries.find(path);
+            if (it != entries.end()) {
+                error = it->second.error;
+                return it->second.program;
+            }
+        }
+        Entry e;
+        if (!isAssemblySource(path)) {
+            e.program = Program::load(path, &e.error);
+        } else {
+            std::string source;
+            if (readSource(path, source, e.error)) e.program = sources.get(source, path, &e.error);
+        }
+        std::lock_guard<std::mutex> lock(m);
+        Entry& kept = entries.emplace(path, std::move(e)).first->second;
+        error = kept.error;
+        return kept.program;
+    }
+
+private:
+    struct Entry {
+        std::shared_ptr<const Program> program;
+        std::string error;
+    };
+    AssemblyCache& sources;
+    std::mutex m;
+    std::map<std::string, Entry> entries;
+};
+
+// Runs one job start to finish on a machine nothing else touches.
+static BatchResult runJob(const BatchJob& job, ProgramCache& programs,
+                          const std::function<void(VirtualMachine&)>& configure) {
+    BatchResult r;
+    std::shared_ptr<const Program> program = programs.get(job.program, r.error);
+    if (!program) return r;
+
+    StringSink sink;
+    VirtualMachine vm(std::move(program));
+    vm.setOutput(&sink);
+    configure(vm);
+
+    if (!job.memoryImage.empty()) {
+        std::vector<int> cells;
+        if (!readMemoryImage(job.memoryImage, cells, r.error)) return r;
+        if (!vm.setMemory(cells)) {
+            r.error = "Memory image " + job.memoryImage + " has " + std::to_string(cells.size())
+                    + " cells, more than the machine's memory";
+            return r;
+        }
+    }
+
+    vm.runBytecode();
+    r.output = sink.str();
+    r.instructions = vm.instructionCount();
+    r.ok = true;
+    return r;
+}
+
+void runBatch(const std::vector<BatchJob>& jobs, int threads,
+              const std::function<void(VirtualMachine&)>& configure,
+              const std::function<void(size_t, const BatchResult&)>& done,
+              AssemblyCache* sources) {
+    std::vector<BatchResult> results(jobs.size());
+    std::vector<char> finished(jobs.size(), 0);
+    std::mutex m;
+    std::condition_variable cv;
+    std::atomic<size_t> next{0};
+    AssemblyCache ownSources;
+    ProgramCache programs(sources ? *sources : ownSources);
+
+    auto worker = [&]() {
+        for (size_t i; (i = next++) < jobs.size(); ) {
+            BatchResult r = runJob(jobs[i], programs, configure);
+            {
+                std::lock_guard<std::mutex> lock(m);
+                results[i] = std::move(r);
+                finished[i] = 1;
+            }
+            cv.notify_all();
+        }
+    };
+
+    threads = std::max(1, std::min<int>(threads, (int)jobs.size()));
+    std::vector<std::thread> pool;
+    for (int t = 0; t < threads; ++t) pool.emplace_back(worker);
+
+    // hand results back in order while later jobs are still running
+    for (size_t i = 0; i < jobs.size(); ++i) {
+        std::unique_lock<std::mutex> lock(m);
+        cv.wait(lock, [&] { return finished[i] != 0; });
+        lock.unlock();
+        done(i, results[i]);
+        results[i] = BatchResult{};  // drop its output once reported
+    }
+    for (std::thread& t : pool) t.join();
+}
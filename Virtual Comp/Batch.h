@@ -0,0 +1,42 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+#include "VirtualMachine.h"
+
+// One line of a batch manifest: a program and, optionally, a memory image
+// to load before running it.
+struct BatchJob {
+    std::string program;
+    std::string memoryImage;  // empty: memory starts zeroed
+};
+
+struct BatchResult {
+    bool ok = false;
+    std::string output;       // everything the program printed
+    std::string error;        // why the job failed, if it did
+    uint64_t instructions = 0;
+};
+
+// Reads a manifest: one job per line, `program.bin [memory.img]`. Blank
+// lines and lines starting with '#' are skipped; relative paths are taken
+// from the manifest's directory.
+bool readManifest(const std::string& path, std::vector<BatchJob>& jobs, std::string& error);
+
+// Reads a memory image: whitespace-separated integers for cells 0, 1, ...
+bool readMemoryImage(const std::string& path, std::vector<int>& cells, std::string& error);
+
+// Runs every job on its own VirtualMachine, with its own output sink, on
+// `threads` worker threads; jobs naming the same program share one loaded
+// Program. Programs ending in .asm are assembled in-process through
+// `sources` (a private in-memory cache when null). `configure` is applied
+// to each machine before it runs and may be called from several threads
+// at once. `done` is called on the calling thread once per job, in
+// manifest order, as soon as that job and every job before it have
+// finished.
+void runBatch(const std::vector<BatchJob>& jobs, int threads,
+              const std::function<void(VirtualMachine&)>& configure,
+              const std::function<void(size_t, const BatchResult&)>& done,
+              AssemblyCache* sources = nullptr);
@@ -0,0 +1,169 @@
+#include "Bench.h"
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include "Asm.h"
+#include "Jit.h"
+#include "VirtualMachine.h"
+
+namespace {
+
+// Builds a kernel's source one instruction per line, so a jump target can
+// be given as the index of the instruction to resume at.
+class Source {
+public:
+    int here() const { return count; }
+    Source& operator()(const std::string& line) {
+        text += line + "\n";
+        if (line[0] != ';' && line[0] != '.') ++count;
+        return *this;
+    }
+    std::string text;
+
+private:
+    int count = 0;
+};
+
+std::string n(int64_t v) { return std::to_string(v); }
+
+// The common frame: `setup` once, then `body` followed by DECR / CMP
+// COUNTER R1 / JGT back to the body, `iterations` times.
+template <class Setup, class Body>
+std::string loop(const std::string& what, uint64_t iterations, Setup setup, Body body) {
+    Source s;
+    s("; " + what);
+    s("MOV R1 " + n(-int64_t(iterations)));
+    setup(s);
+    const int top = s.here();
+    body(s);
+    s("DECR")("CMP COUNTER R1")("JGT " + n(top))("CEASE");
+    return s.text;
+}
+
+}  // namespace
+
+std::vector<BenchKernel> benchKernels(uint64_t instructions) {
+    std::vector<BenchKernel> k;
+    auto iterations = [&](uint64_t perIteration) { return std::max<uint64_t>(1, instructions / perIteration); };
+
+    k.push_back({"counter", "DECR / CMP COUNTER / JGT and nothing else", ""});
+    k.back().source = loop(k.back().what, iterations(3), [](Source&) {}, [](Source&) {});
+
+    k.push_back({"arith", "register ADDR chains, values kept bounded", ""});
+    k.back().source = loop(k.back().what, iterations(11),
+        [](Source& s) { s("MOV R2 1")("MOV R3 5")("MOV R7 -5"); },
+        [](Source& s) {
+            s("ADDR R2 R2 R3")("ADDR R4 R2 R3")("ADDR R2 R2 R7")("ADDR R5 R4 R7");
+            s("ADDR R6 R5 R4")("ADDR R4 R6 R7")("MOV R6 0")("ADDR R5 R5 R3");
+        });
+
+    k.push_back({"alu", "immediate and logical ALU ops, no constants held in registers", ""});
+    k.back().source = loop(k.back().what, iterations(11),
+        [](Source&) {},
+        [](Source& s) {
+            s("ADDI R2 R2 12345")("MULI R3 R2 3")("ANDI R3 R3 0xFFFF")("SHLI R4 R3 4");
+            s("XORR R5 R4 R2")("SARI R5 R5 2")("ORI R6 R5 1")("INC R7");
+        });
+
+    const int cells = 256;
+    k.push_back({"memory", "stream 256 cells through a register into 256 others", ""});
+    k.back().source = loop(k.back().what, iterations(3 * cells + 3),
+        [&](Source& s) { s(".memory " + n(2 * cells))("MOV R2 1"); },
+        [&](Source& s) {
+            for (int i = 0; i < cells; ++i)
+                s("LOADMR R3 " + n(i))("ADDR R4 R3 R2")("STOREMR " + n(cells + i) + " R4");
+        });
+
+    k.push_back({"stack", "PUSH / LOADR / LOADM against STORER / STOREM", ""});
+    k.back().source = loop(k.back().what, iterations(13),
+        [](Source& s) { s("MOV R2 4"); },
+        [](Source& s) {
+            s("PUSH 3")("PUSH 4")("LOADR R2")("STORER R3")("STORER R4");
+            s("STORER R5")("LOADM 7")("PUSH 9")("STOREM 8")("STORER R6");
+        });
+
+    // every iteration takes the other side of the first JEQ; four of the
+    // conditional jumps run per iteration, half of them taken
+    k.push_back({"branch", "data-dependent conditional jumps, alternating paths", ""});
+    {
+        Source s;
+        s("; " + k.back().what);
+        s("MOV R1 " + n(-int64_t(iterations(9))))("MOV R0 0")("MOV R2 0")("MOV R3 1");
+        const int top = s.here();
+        const int even = top + 6, join = top + 10, end = top + 13;
+        s("CMP R2 R0")("JEQ " + n(even));                                        // R2 == 0: even
+        s("MOV R2 0")("CMP R2 R3")("JGT " + n(end))("JLT " + n(join));           // odd
+        s("MOV R2 1")("CMP R2 R0")("JLT " + n(end))("JEQ " + n(end));            // even
+        s("DECR")("CMP COUNTER R1")("JGT " + n(top))("CEASE");
+        k.back().source = s.text;
+    }
+
+    // the subroutine follows the loop's CEASE; --inline would remove both
+    // calls, which the suite doesn't do
+    k.push_back({"call", "CALL / RET of a three-op leaf subroutine, twice an iteration", ""});
+    k.back().source = loop(k.back().what, iterations(13),
+        [](Source& s) { s("MOV R2 0"); },
+        [](Source& s) { s("CALL leaf")("CALL leaf"); });
+    k.back().source += "leaf:\nADDI R2 R2 3\nXORI R3 R2 5\nANDI R2 R2 0xFFFF\nRET\n";
+
+    // as many iterations as the memory kernel, so the two move the same
+    // number of cells: compare their ms, not their ns/instr
+    k.push_back({"vector", "the memory kernel's work as block ops, plus reductions", ""});
+    k.back().source = loop(k.back().what, iterations(3 * cells + 3),
+        [&](Source& s) { s(".memory " + n(3 * cells))("MOV R2 1")("VFILL " + n(2 * cells) + " R2 " + n(cells)); },
+        [&](Source& s) {
+            s("VCOPY " + n(cells) + " 0 " + n(cells))("VADD " + n(cells) + " " + n(2 * cells) + " " + n(cells));
+            s("VSUM R3 " + n(cells) + " " + n(cells))("VMAX R4 " + n(cells) + " " + n(cells));
+            s("MOV R5 1")("VCNT R5 " + n(cells) + " " + n(cells));
+        });
+    return k;
+}
+
+bool runBenchSuite(std::ostream& os, const std::string& only, int reps, uint64_t instructions) {
+    struct Engine { const char* name; bool jit, tiered; };
+    std::vector<Engine> engines = {{"interp", false, false}, {"tiered", false, true}};
+    if (Jit::supported()) engines.push_back({"jit", true, false});
+
+    os << std::left << std::setw(10) << "[SUITE]" << std::setw(10) << "kernel" << std::setw(8) << "engine"
+       << std::right << std::setw(14) << "instructions" << std::setw(10) << "ms" << std::setw(10) << "ns/instr"
+       << std::setw(10) << "MIPS" << "\n";
+    bool any = false;
+    for (const BenchKernel& kernel : benchKernels(instructions)) {
+        if (only != "all" && only != kernel.name) continue;
+        any = true;
+        std::vector<uint8_t> image;
+        std::string error;
+        std::shared_ptr<const Program> program;
+        if (assemble(kernel.source, image, error))
+            program = Program::fromMemory(image.data(), image.size(), kernel.name, &error);
+        if (!program) {
+            std::cerr << kernel.name << ": " << error << "\n";
+            return false;
+        }
+
+        for (const Engine& e : engines) {
+            double best = 0;
+            uint64_t count = 0;
+            NullSink sink;
+            for (int r = 0; r < std::max(1, reps); ++r) {
+                VirtualMachine vm(program);
+                vm.setOutput(&sink);
+                vm.setQuiet(true);
+                vm.setJit(e.jit);
+                vm.setTiered(e.tiered);
+                auto t0 = std::chrono::steady_clock::now();
+                vm.runBytecode();
+                double s = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+                if (!r || s < best) best = s;
+                count = vm.instructionCount();
+            }
+            os << std::left << std::setw(10) << "[SUITE]" << std::setw(10) << kernel.name << std::setw(8) << e.name
+               << std::right << std::setw(14) << count << std::fixed << std::setprecision(2)
+               << std::setw(10) << best * 1e3 << std::setw(10) << (count ? best * 1e9 / count : 0.0)
+               << std::setw(10) << (best > 0 ? count / best / 1e6 : 0.0) << std::defaultfloat << "\n";
+        }
+    }
+    if (!any) std::cerr << "no kernel named " << only << "\n";
+    return any;
+}
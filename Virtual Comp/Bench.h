@@ -0,0 +1,26 @@
+#pragma once
+#include <cstdint>
+#include <iosfwd>
+#include <string>
+#include <vector>
+
+// Built-in micro-benchmark kernels (--bench-suite). Each one is assembly
+// source generated in-process and stresses one part of the machine: loop
+// control on COUNTER, register arithmetic, the immediate and logical ALU
+// ops, memory streaming, stack traffic, conditional branches or the block
+// memory ops.
+struct BenchKernel {
+    std::string name;
+    std::string what;    // one-line description
+    std::string source;  // assembly
+};
+
+// Every kernel, sized so each runs roughly `instructions` instructions.
+std::vector<BenchKernel> benchKernels(uint64_t instructions);
+
+// Runs the kernels whose name matches `only` ("all" for every one) on the
+// interpreter, the tiered runner and the JIT (where supported), `reps`
+// times each on fresh machines with output discarded, and prints the best
+// run of each as ns per instruction and MIPS. False if a kernel fails to
+// load or `only` matches nothing.
+bool runBenchSuite(std::ostream& os, const std::string& only, int reps, uint64_t instructions);
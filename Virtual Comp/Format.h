@@ -0,0 +1,53 @@
+#pragma once
+#include <cstdint>
+
+// On-disk bytecode container, shared by the VM's loader and the assembler.
+// All fields are little-endian. A container is a fixed header followed by
+// its sections, back to back, in this order:
+//
+//   header    ContainerHeader (headerSize bytes)
+//   code      codeCount CodeRecord entries
+//   data      dataCount int32 cells, loaded into memory from cell 0
+//   symbols   symbolsSize bytes of {uint32 line, uint32 length, name[length]}
+//
+// Files that don't start with the magic are legacy bytecode: a bare stream
+// of 4-byte {opcode, a, b, c} records with 8-bit operands.
+
+constexpr char VMBC_MAGIC[4] = {'V', 'M', 'B', 'C'};
+constexpr uint16_t VMBC_VERSION = 1;
+
+struct ContainerHeader {
+    char magic[4];
+    uint16_t version;
+    uint16_t headerSize;     // lets later versions grow the header
+    uint32_t codeCount;      // records in the code section
+    uint32_t dataCount;      // cells in the data section
+    uint32_t symbolsSize;    // bytes in the symbol section; 0 if absent
+    uint32_t memoryCells;    // memory the program needs; 0: the VM default
+    uint32_t flags;          // VMBC_FLAG_* bits
+    uint32_t reserved;
+};
+static_assert(sizeof(ContainerHeader) == 32, "container header layout");
+
+// ContainerHeader::flags
+enum : uint32_t {
+    // compiled from text mode (compileText): CMP echoes its operand names
+    // and CPRINT prints the bare counter, as the text interpreter did
+    VMBC_FLAG_TEXT = 0x1,
+};
+
+// One instruction. Operands are 32 bits wide: registers 0-7 (0xFF is
+// COUNTER), memory addresses, jump targets (the line to resume at) and
+// MOV immediates.
+struct CodeRecord {
+    uint8_t opcode;
+    uint8_t pad[3];
+    int32_t a, b, c;
+};
+static_assert(sizeof(CodeRecord) == 16, "code record layout");
+
+// One record of the legacy headerless format.
+struct LegacyRecord {
+    uint8_t opcode;
+    uint8_t a, b, c;
+};
@@ -0,0 +1,103 @@
+#include "Golden.h"
+#include <fstream>
+#include <iostream>
+#include "Asm.h"
+#include "VirtualMachine.h"
+
+namespace {
+
+std::string trimRight(std::string s) {
+    while (!s.empty() && (s.back() == '\r' || s.back() == ' ' || s.back() == '\t')) s.pop_back();
+    return s;
+}
+
+}  // namespace
+
+bool readGoldenFile(const std::string& path, std::vector<GoldenCase>& cases, std::string& error) {
+    std::ifstream in(path);
+    if (!in) {
+        error = "cannot open " + path;
+        return false;
+    }
+    enum { BETWEEN, SOURCE, EXPECTED } state = BETWEEN;
+    std::string raw;
+    for (int lineNo = 1; std::getline(in, raw); ++lineNo) {
+        std::string line = trimRight(raw);
+        switch (state) {
+            case BETWEEN:
+                if (line.empty()) break;
+                cases.push_back({line, "", "", lineNo});
+                state = SOURCE;
+                break;
+            case SOURCE:
+                if (line == "Expect:") state = EXPECTED;
+                else cases.back().source += line + "\n";
+                break;
+            case EXPECTED:
+                if (line.empty()) state = BETWEEN;
+                else cases.back().expected += line + "\n";
+                break;
+        }
+    }
+    if (state == SOURCE) {
+        error = path + ":" + std::to_string(cases.back().line) + ": '" + cases.back().title + "' has no Expect: block";
+        return false;
+    }
+    return true;
+}
+
+bool runGolden(std::ostream& os, const std::string& path) {
+    std::vector<GoldenCase> cases;
+    std::string error;
+    if (!readGoldenFile(path, cases, error)) {
+        std::cerr << error << "\n";
+        return false;
+    }
+
+    int failed = 0, checks = 0;
+    for (const GoldenCase& c : cases) {
+        std::vector<uint8_t> image;
+        std::shared_ptr<const Program> program;
+        if (assemble(c.source, image, error))
+            program = Program::fromMemory(image.data(), image.size(), c.title, &error);
+        if (!program) {
+            os << "FAIL " << c.title << " (line " << c.line << "): " << error << "\n";
+            ++failed;
+            continue;
+        }
+
+        StringSink interpOut;
+        VirtualMachine interp(program);
+        interp.setOutput(&interpOut);
+        interp.setQuiet(true);
+        interp.runBytecode();
+
+        for (const char* engine : {"interp", "jit", "tiered", "paged", "profiled"}) {
+            StringSink otherOut;
+            VirtualMachine other(program);
+            other.setOutput(&otherOut);
+            other.setQuiet(true);
+            const std::string e = engine;
+            if (e == "jit") other.setJit(true);
+            if (e == "tiered" || e == "paged") {
+                other.setTiered(true);
+                other.setTierConfig({1, 2});  // low enough to reach every tier
+            }
+            if (e == "paged") other.setMemorySize(Memory::FLAT_LIMIT + 1);
+            if (e == "profiled") other.setProfiling(true);
+            other.runBytecode();
+
+            std::string why;
+            if (otherOut.str() != c.expected)
+                why = "output differs:\n--- expected\n" + c.expected + "--- got\n" + otherOut.str();
+            else if (e != "interp")
+                why = interp.diffState(other);
+            os << (why.empty() ? "PASS " : "FAIL ") << c.title << " (" << engine << ")"
+               << (why.empty() ? "" : ": " + why) << "\n";
+            ++checks;
+            failed += !why.empty();
+        }
+    }
+    os << "[GOLDEN] " << cases.size() << " case(s), " << checks << " check(s), " << failed << " failed\n";
+    return failed == 0;
+}
@@ -0,0 +1,23 @@
+#pragma once
+#include <iosfwd>
+#include <string>
+#include <vector>
+
+// One case of a golden-output file such as expectations.ex.txt: a title
+// line, the program's source, then an `Expect:` line followed by the exact
+// output (CMP/memory echo off), up to the next blank line.
+struct GoldenCase {
+    std::string title;
+    std::string source;
+    std::string expected;
+    int line = 0;  // where the title is, for messages
+};
+
+bool readGoldenFile(const std::string& path, std::vector<GoldenCase>& cases, std::string& error);
+
+// Assembles and runs every case on the interpreter, the JIT, the tiered
+// runner, paged memory and the profiled interpreter, and checks each
+// engine's output against the expected text and its final state against
+// the interpreter's. Prints PASS/FAIL per case and engine; false on any
+// failure.
+bool runGolden(std::ostream& os, const std::string& path);
@@ -0,0 +1,385 @@
+#include "Jit.h"
+#include <cstddef>
+#include <cstring>
+
+#if VM_JIT
+#include <sys/mman.h>
+#endif
+
+namespace {
+
+// Small x86-64 emitter. Machine state is addressed as [rbx + disp32]
+// (rbx = JitContext*), memory cells as [r13 + disp32] (r13 = ctx->mem),
+// and r12 counts retired instructions.
+struct Emitter {
+    std::vector<uint8_t> code;
+
+    size_t here() const { return code.size(); }
+    void byte(uint8_t b) { code.push_back(b); }
+    void bytes(std::initializer_list<uint8_t> bs) { code.insert(code.end(), bs); }
+    void imm32(int32_t v) {
+        uint8_t b[4];
+        std::memcpy(b, &v, 4);
+        code.insert(code.end(), b, b + 4);
+    }
+    void imm64(const void* p) {
+        uint8_t b[8];
+        uint64_t v = uint64_t(reinterpret_cast<uintptr_t>(p));
+        std::memcpy(b, &v, 8);
+        code.insert(code.end(), b, b + 8);
+    }
+    void patch32(size_t at, int32_t v) { std::memcpy(&code[at], &v, 4); }
+
+    // --- [rbx + d] forms (ModRM mod=10, rm=011) ---
+    void loadEax(int32_t d)      { bytes({0x8B, 0x83}); imm32(d); }        // mov eax, [rbx+d]
+    void storeEax(int32_t d)     { bytes({0x89, 0x83}); imm32(d); }        // mov [rbx+d], eax
+    void addEax(int32_t d)       { bytes({0x03, 0x83}); imm32(d); }        // add eax, [rbx+d]
+    void subEax(int32_t d)       { bytes({0x2B, 0x83}); imm32(d); }        // sub eax, [rbx+d]
+    void cmpEax(int32_t d)       { bytes({0x3B, 0x83}); imm32(d); }        // cmp eax, [rbx+d]
+    void imulEax(int32_t d)      { bytes({0x0F, 0xAF, 0x83}); imm32(d); }  // imul eax, [rbx+d]
+    void andEax(int32_t d)       { bytes({0x23, 0x83}); imm32(d); }        // and eax, [rbx+d]
+    void orEax(int32_t d)        { bytes({0x0B, 0x83}); imm32(d); }        // or eax, [rbx+d]
+    void xorEax(int32_t d)       { bytes({0x33, 0x83}); imm32(d); }        // xor eax, [rbx+d]
+    void loadEcx(int32_t d)      { bytes({0x8B, 0x8B}); imm32(d); }        // mov ecx, [rbx+d]
+    void storeImm(int32_t d, int32_t v) { bytes({0xC7, 0x83}); imm32(d); imm32(v); }  // mov dword [rbx+d], v
+    void incMem(int32_t d)       { bytes({0xFF, 0x83}); imm32(d); }        // inc dword [rbx+d]
+    void decMem(int32_t d)       { bytes({0xFF, 0x8B}); imm32(d); }        // dec dword [rbx+d]
+    void setcc(uint8_t cc, int32_t d) { bytes({0x0F, cc, 0x83}); imm32(d); }  // setcc byte [rbx+d]
+    void testByte(int32_t d)     { bytes({0x80, 0xBB}); imm32(d); byte(0); }  // cmp byte [rbx+d], 0
+    void storeByte(int32_t d, uint8_t v) { bytes({0xC6, 0x83}); imm32(d); byte(v); }  // mov byte [rbx+d], v
+
+    // --- eax with an immediate ---
+    void addEaxImm(int32_t v)    { byte(0x05); imm32(v); }                 // add eax, v
+    void andEaxImm(int32_t v)    { byte(0x25); imm32(v); }                 // and eax, v
+    void orEaxImm(int32_t v)     { byte(0x0D); imm32(v); }                 // or eax, v
+    void xorEaxImm(int32_t v)    { byte(0x35); imm32(v); }                 // xor eax, v
+    void cmpEaxImm(int32_t v)    { byte(0x3D); imm32(v); }                 // cmp eax, v
+    void imulEaxImm(int32_t v)   { bytes({0x69, 0xC0}); imm32(v); }        // imul eax, eax, v
+    // shifts of eax by cl (ext 4 shl, 5 shr, 7 sar) or by an immediate
+    void shiftEaxCl(uint8_t ext) { bytes({0xD3, uint8_t(0xC0 | ext << 3)}); }
+    void shiftEaxImm(uint8_t ext, int32_t n) { bytes({0xC1, uint8_t(0xC0 | ext << 3), uint8_t(n)}); }
+
+    // --- [r13 + d] forms ---
+    void loadEaxMem(int32_t d)   { bytes({0x41, 0x8B, 0x85}); imm32(d); }  // mov eax, [r13+d]
+    void storeEaxMem(int32_t d)  { bytes({0x41, 0x89, 0x85}); imm32(d); }  // mov [r13+d], eax
+
+    void addR12(int32_t n)       { bytes({0x49, 0x81, 0xC4}); imm32(n); }  // add r12, n
+
+    // --- the return stack, through rcx ---
+    void loadRcx(int32_t d)      { bytes({0x48, 0x8B, 0x8B}); imm32(d); }  // mov rcx, [rbx+d]
+    void storeRcx(int32_t d)     { bytes({0x48, 0x89, 0x8B}); imm32(d); }  // mov [rbx+d], rcx
+    void cmpRcx(int32_t d)       { bytes({0x48, 0x3B, 0x8B}); imm32(d); }  // cmp rcx, [rbx+d]
+    void addRcx(int8_t n)        { bytes({0x48, 0x83, 0xC1, uint8_t(n)}); }  // add rcx, n
+    void storeImmRcx(int32_t v)  { bytes({0xC7, 0x01}); imm32(v); }        // mov dword [rcx], v
+    void loadEaxRcx()            { bytes({0x8B, 0x01}); }                  // mov eax, [rcx]
+
+    // --- links to code in other ranges, through rax/rdx ---
+    void movRaxImm(const void* p) { bytes({0x48, 0xB8}); imm64(p); }       // mov rax, p
+    void movRdxImm(const void* p) { bytes({0x48, 0xBA}); imm64(p); }       // mov rdx, p
+
+    // jumps with a rel32 to patch later; returns the rel32 position
+    size_t jcc(uint8_t cc) { bytes({0x0F, cc}); size_t at = here(); imm32(0); return at; }
+    size_t jmp()           { byte(0xE9); size_t at = here(); imm32(0); return at; }
+};
+
+constexpr uint8_t CC_E = 0x84, CC_NE = 0x85;              // jcc opcodes (second byte)
+constexpr uint8_t SET_E = 0x94, SET_G = 0x9F, SET_L = 0x9C;  // setcc opcodes
+constexpr uint8_t SHL = 4, SHR = 5, SAR = 7;               // shift group ModRM reg fields
+
+constexpr int32_t REG(int r)   { return int32_t(offsetof(JitContext, regs) + 4 * r); }
+constexpr int32_t COUNTER      = offsetof(JitContext, counter);
+constexpr int32_t FLAG_EQ      = offsetof(JitContext, flag_eq);
+constexpr int32_t FLAG_GT      = offsetof(JitContext, flag_gt);
+constexpr int32_t FLAG_LT      = offsetof(JitContext, flag_lt);
+constexpr int32_t MEM          = offsetof(JitContext, mem);
+constexpr int32_t RETIRED      = offsetof(JitContext, retired);
+constexpr int32_t CALLS        = offsetof(JitContext, calls);
+constexpr int32_t CALLS_BASE   = offsetof(JitContext, callsBase);
+constexpr int32_t CALLS_FULL   = offsetof(JitContext, callsFull);
+constexpr int32_t BAILED       = offsetof(JitContext, bailed);
+
+} // namespace
+
+
+bool Jit::canCompile(const Op& op, bool echo, bool flatMemory) {
+    switch (op.code) {
+        case X_MOV: case X_ADDR: case X_SUBR: case X_DECR:
+        case X_MULR: case X_ANDR: case X_ORR: case X_XORR: case X_SHLR: case X_SHRR: case X_SARR:
+        case X_ADDI: case X_MULI: case X_ANDI: case X_ORI: case X_XORI: case X_SHLI: case X_SHRI: case X_SARI:
+        case X_INC: case X_DEC: case X_INCC:
+        case X_JEQ: case X_JNE: case X_JGT: case X_JLT: case X_JMP:
+        case X_CALL: case X_RET:
+            return true;
+        case X_CMP_RR: case X_CMP_CR: case X_CMP_RC: case X_CMP_CC: case X_CMP_RI: case X_CMP_CI:
+            return !echo;
+        case X_LOADMR: case X_STOREMR:
+            return !echo && flatMemory;
+        default:
+            return false;
+    }
+}
+
+
+Jit::~Jit() { release(); }
+
+void Jit::release() {
+#if VM_JIT
+    for (auto& c : chunks) munmap(c.base, c.size);
+#endif
+    chunks.clear();
+    size = 0;
+    entries.clear();
+    compiled = 0;
+}
+
+bool Jit::compile(const std::vector<Op>& ops, bool echo, bool flatMemory) {
+    release();
+    return compileRange(ops, echo, flatMemory, 0, (int)ops.size() - 1);  // ops[n] is HALT
+}
+
+bool Jit::compileRange(const std::vector<Op>& ops, bool echo, bool flatMemory, int first, int last) {
+#if !VM_JIT
+    (void)ops; (void)echo; (void)flatMemory; (void)first; (void)last;
+    return false;
+#else
+    const int n = (int)ops.size() - 1;
+    if (n < 0 || first < 0 || last > n || first >= last) return false;
+    if (entries.empty()) entries.assign(n + 1, Entry{});
+
+    // jump targets start a new count batch, so incoming edges don't
+    // double count instructions retired on the fall-through path
+    std::vector<bool> leader(last - first + 1, false);
+    for (int i = first; i < last; ++i) {
+        switch (ops[i].code) {
+            case X_JEQ: case X_JNE: case X_JGT: case X_JLT: case X_JMP:
+            case X_JZ: case X_JNZ: case X_CJNZ: case X_CALL:
+                if (ops[i].a >= first && ops[i].a <= last) leader[ops[i].a - first] = true;
+                break;
+        }
+    }
+
+    Emitter e;
+    // prologue: int fn(JitContext* ctx /*rdi*/, const void* entry /*rsi*/)
+    e.bytes({0x53, 0x41, 0x54, 0x41, 0x55});   // push rbx; push r12; push r13
+    e.bytes({0x48, 0x89, 0xFB});               // mov rbx, rdi
+    e.bytes({0x4C, 0x8B, 0xAB}); e.imm32(MEM);  // mov r13, [rbx+mem]
+    e.bytes({0x45, 0x31, 0xE4});               // xor r12d, r12d
+    e.bytes({0xFF, 0xE6});                     // jmp rsi
+
+    std::vector<size_t> at(last - first + 1);
+    std::vector<std::pair<size_t, int>> fixups;  // rel32 position -> op index
+    std::vector<size_t> exits;                   // rel32 positions -> epilogue
+    std::vector<std::pair<size_t, int>> bails;   // rel32 position -> op the interpreter runs instead
+    std::vector<bool> native(last - first + 1, false);
+    int pending = 0;
+
+    auto flush = [&]() { if (pending) { e.addR12(pending); pending = 0; } };
+    auto exitTo = [&](int i) {  // hand op i back to the interpreter
+        e.byte(0xB8); e.imm32(i);  // mov eax, i
+        exits.push_back(e.jmp());
+    };
+    // Leaving the range for op t: straight into t's native code if another
+    // range has compiled it by the time this runs, else out to the
+    // interpreter. Every range keeps rbx, r12 and r13 and the same frame,
+    // so any range's epilogue can return for this one.
+    auto leaveTo = [&](int t) {
+        if (t < n) {
+            e.movRaxImm(&entries[t].code);
+            e.bytes({0x48, 0x8B, 0x00});  // mov rax, [rax]
+            e.bytes({0x48, 0x85, 0xC0});  // test rax, rax
+            size_t none = e.jcc(CC_E);
+            e.bytes({0xFF, 0xE0});        // jmp rax
+            e.patch32(none, int32_t(e.here() - (none + 4)));
+        }
+        exitTo(t);
+    };
+
+    for (int i = first; i <= last; ++i) {
+        const Op& op = ops[i];
+        if (leader[i - first]) flush();
+
+        if (i == last || !canCompile(op, echo, flatMemory)) {
+            flush();
+            at[i - first] = e.here();
+            if (i == last) leaveTo(i);
+            else exitTo(i);
+            continue;
+        }
+
+        at[i - first] = e.here();
+        native[i - first] = true;
+        ++compiled;
+        ++pending;
+
+        switch (op.code) {
+            case X_MOV:
+                e.storeImm(REG(op.a), op.b);
+                break;
+            case X_ADDR:
+            case X_SUBR:
+                e.loadEax(REG(op.b));
+                if (op.code == X_ADDR) e.addEax(REG(op.c));
+                else e.subEax(REG(op.c));
+                e.storeEax(REG(op.a));
+                break;
+            case X_MULR: case X_ANDR: case X_ORR: case X_XORR:
+                e.loadEax(REG(op.b));
+                switch (op.code) {
+                    case X_MULR: e.imulEax(REG(op.c)); break;
+                    case X_ANDR: e.andEax(REG(op.c)); break;
+                    case X_ORR:  e.orEax(REG(op.c)); break;
+                    default:     e.xorEax(REG(op.c)); break;
+                }
+                e.storeEax(REG(op.a));
+                break;
+            case X_SHLR: case X_SHRR: case X_SARR:  // the CPU takes cl mod 32, as the VM does
+                e.loadEax(REG(op.b));
+                e.loadEcx(REG(op.c));
+                e.shiftEaxCl(op.code == X_SHLR ? SHL : op.code == X_SHRR ? SHR : SAR);
+                e.storeEax(REG(op.a));
+                break;
+            case X_ADDI: case X_MULI: case X_ANDI: case X_ORI: case X_XORI:
+            case X_SHLI: case X_SHRI: case X_SARI:
+                e.loadEax(REG(op.b));
+                switch (op.code) {
+                    case X_ADDI: e.addEaxImm(op.c); break;
+                    case X_MULI: e.imulEaxImm(op.c); break;
+                    case X_ANDI: e.andEaxImm(op.c); break;
+                    case X_ORI:  e.orEaxImm(op.c); break;
+                    case X_XORI: e.xorEaxImm(op.c); break;
+                    case X_SHLI: e.shiftEaxImm(SHL, op.c); break;
+                    case X_SHRI: e.shiftEaxImm(SHR, op.c); break;
+                    default:     e.shiftEaxImm(SAR, op.c); break;
+                }
+                e.storeEax(REG(op.a));
+                break;
+            case X_INC:
+                e.incMem(REG(op.a));
+                break;
+            case X_DEC:
+                e.decMem(REG(op.a));
+                break;
+            case X_INCC:
+                e.incMem(COUNTER);
+                break;
+            case X_DECR:
+                e.decMem(COUNTER);
+                break;
+            case X_CMP_RI: case X_CMP_CI:
+                e.loadEax(op.code == X_CMP_CI ? COUNTER : REG(op.a));
+                e.cmpEaxImm(op.b);
+                e.setcc(SET_E, FLAG_EQ);
+                e.setcc(SET_G, FLAG_GT);
+                e.setcc(SET_L, FLAG_LT);
+                break;
+            case X_CMP_RR: case X_CMP_CR: case X_CMP_RC: case X_CMP_CC: {
+                int lhs = (op.code == X_CMP_CR || op.code == X_CMP_CC) ? COUNTER : REG(op.a);
+                int rhs = (op.code == X_CMP_RC || op.code == X_CMP_CC) ? COUNTER : REG(op.b);
+                e.loadEax(lhs);
+                e.cmpEax(rhs);
+                e.setcc(SET_E, FLAG_EQ);
+                e.setcc(SET_G, FLAG_GT);
+                e.setcc(SET_L, FLAG_LT);
+                break;
+            }
+            case X_LOADMR:
+                e.loadEaxMem(4 * op.b);
+                e.storeEax(REG(op.a));
+                break;
+            case X_STOREMR:
+                e.loadEax(REG(op.b));
+                e.storeEaxMem(4 * op.a);
+                break;
+            case X_JMP:
+                flush();
+                fixups.push_back({e.jmp(), op.a});
+                break;
+            case X_JEQ: case X_JNE: case X_JGT: case X_JLT: {
+                flush();
+                int32_t flag = op.code == X_JGT ? FLAG_GT : op.code == X_JLT ? FLAG_LT : FLAG_EQ;
+                e.testByte(flag);
+                fixups.push_back({e.jcc(op.code == X_JNE ? CC_E : CC_NE), op.a});
+                break;
+            }
+            case X_CALL: case X_RET:
+                // retire what came before, so a bail leaves this op uncounted
+                --pending;
+                flush();
+                e.loadRcx(CALLS);
+                e.cmpRcx(op.code == X_CALL ? CALLS_FULL : CALLS_BASE);
+                bails.push_back({e.jcc(CC_E), i});
+                pending = 1;
+                flush();
+                if (op.code == X_CALL) {
+                    e.addRcx(4);
+                    e.storeImmRcx(i + 1);
+                    e.storeRcx(CALLS);
+                    fixups.push_back({e.jmp(), op.a});
+                } else {
+                    // on to entries[eax].code if the caller is compiled
+                    e.loadEaxRcx();
+                    e.addRcx(-4);
+                    e.storeRcx(CALLS);
+                    static_assert(sizeof(Entry) == 16, "entries are indexed by eax << 4");
+                    e.bytes({0x89, 0xC1});              // mov ecx, eax
+                    e.bytes({0x48, 0xC1, 0xE1, 0x04});  // shl rcx, 4
+                    e.movRdxImm(entries.data());
+                    e.bytes({0x48, 0x8B, 0x14, 0x0A});  // mov rdx, [rdx+rcx]
+                    e.bytes({0x48, 0x85, 0xD2});        // test rdx, rdx
+                    exits.push_back(e.jcc(CC_E));
+                    e.bytes({0xFF, 0xE2});              // jmp rdx
+                }
+                break;
+        }
+    }
+
+    // jumps that leave the range exit to the interpreter at their target
+    std::vector<std::pair<size_t, size_t>> outside;  // rel32 position -> stub
+    for (auto& f : fixups) {
+        if (f.second >= first && f.second <= last) continue;
+        size_t stub = e.here();
+        leaveTo(f.second);
+        outside.push_back({f.first, stub});
+    }
+    for (auto& b : bails) {
+        outside.push_back({b.first, e.here()});
+        e.storeByte(BAILED, 1);
+        exitTo(b.second);
+    }
+
+    // epilogue: eax holds the op index to resume at
+    size_t epilogue = e.here();
+    e.bytes({0x4C, 0x89, 0xA3}); e.imm32(RETIRED);  // mov [rbx+retired], r12
+    e.bytes({0x41, 0x5D, 0x41, 0x5C, 0x5B, 0xC3});  // pop r13; pop r12; pop rbx; ret
+
+    for (auto& f : fixups)
+        if (f.second >= first && f.second <= last)
+            e.patch32(f.first, int32_t(at[f.second - first] - (f.first + 4)));
+    for (auto& o : outside) e.patch32(o.first, int32_t(o.second - (o.first + 4)));
+    for (size_t x : exits) e.patch32(x, int32_t(epilogue - (x + 4)));
+
+    size_t bytes = e.code.size();
+    void* mem = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED) return false;
+    std::memcpy(mem, e.code.data(), bytes);
+    if (mprotect(mem, bytes, PROT_READ | PROT_EXEC) != 0) {
+        munmap(mem, bytes);
+        return false;
+    }
+    uint8_t* base = static_cast<uint8_t*>(mem);
+    chunks.push_back({base, bytes});
+    size += bytes;
+
+    for (int i = first; i < last; ++i)
+        if (native[i - first]) entries[i] = {base + at[i - first], base};
+    return true;
+#endif
+}
+
+int Jit::run(JitContext& ctx, int pc) const {
+    using Fn = int (*)(JitContext*, const void*);
+    const Entry& e = entries[pc];
+    Fn fn = reinterpret_cast<Fn>(reinterpret_cast<uintptr_t>(e.fn));
+    ctx.bailed = 0;
+    return fn(&ctx, e.code);
+}
@@ -0,0 +1,88 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "Ops.h"
+
+// The JIT is built only for x86-64 hosts with mmap; elsewhere
+// Jit::supported() is false and the VM stays in the interpreter.
+#if defined(__x86_64__) && (defined(__linux__) || defined(__APPLE__))
+#define VM_JIT 1
+#else
+#define VM_JIT 0
+#endif
+
+// Machine state as native code sees it: a fixed layout addressed off one
+// host register. The VM copies its state in before entering native code
+// and back out when native code returns.
+struct JitContext {
+    int32_t regs[8];    // R0-R7
+    int32_t counter;
+    uint8_t flag_eq, flag_gt, flag_lt;
+    int32_t* mem;       // base of VM memory when it is flat
+    uint64_t retired;   // instructions executed natively by the last run()
+    // the return stack, as the interpreter keeps it: `calls` points at the
+    // innermost return address, or at slot 0 (callsBase) when there is none
+    int32_t* calls;
+    int32_t* callsBase;
+    int32_t* callsFull;
+    uint8_t bailed;     // run() returned an op native code could not run; set by run()
+};
+
+// Baseline x86-64 compiler for the decoded op stream. Each op that has a
+// native form is compiled in program order; jumps between native ops are
+// native jumps, so loops made of them never leave machine code. Every op
+// without a native form (I/O, stack ops, division, echoing CMP/memory ops) becomes
+// an exit stub that returns its index so the interpreter can run it.
+// CALL pushes its return address and jumps natively; RET pops one and
+// jumps to the line after the CALL, natively if that line is compiled.
+// A full or empty return stack leaves the op to the interpreter (run()
+// sets ctx.bailed), which reports it.
+// Code can be compiled for the whole program at once or one range of ops
+// at a time, each range in its own buffer, as the tiered runner does.
+// Ranges are linked through `entries`: code leaving one range jumps
+// straight into another's if that op has been compiled by then.
+class Jit {
+public:
+    Jit() = default;
+    ~Jit();
+    Jit(const Jit&) = delete;
+    Jit& operator=(const Jit&) = delete;
+
+    static bool supported() { return VM_JIT; }
+
+    // True if `op` has a native form (with the CMP/memory echo on or off,
+    // and with memory flat or paged).
+    static bool canCompile(const Op& op, bool echo, bool flatMemory);
+
+    // Compiles `ops` (whose last entry is HALT). With `echo` set, CMP and
+    // the memory ops must print, so they are left to the interpreter, as
+    // are the memory ops when memory is paged rather than one flat array.
+    bool compile(const std::vector<Op>& ops, bool echo, bool flatMemory);
+
+    // Adds native code for ops [first, last) alongside whatever is already
+    // compiled. Leaving the range, by falling off its end or jumping out
+    // of it, continues in native code if the op it goes to has an entry
+    // when it gets there (compiled before or after this range), and
+    // returns to the interpreter if not.
+    bool compileRange(const std::vector<Op>& ops, bool echo, bool flatMemory, int first, int last);
+
+    bool has(int pc) const { return pc >= 0 && pc < (int)entries.size() && entries[pc].code; }
+
+    // Runs native code from op `pc`; returns the op index to resume at.
+    int run(JitContext& ctx, int pc) const;
+
+    size_t codeSize() const { return size; }
+    int nativeOps() const { return compiled; }
+
+private:
+    void release();
+
+    struct Chunk { uint8_t* base; size_t size; };
+    struct Entry { const uint8_t* code = nullptr; const uint8_t* fn = nullptr; };
+
+    std::vector<Chunk> chunks;   // one executable buffer per compile call
+    size_t size = 0;
+    std::vector<Entry> entries;  // native entry per op and the prologue to enter it by
+    int compiled = 0;
+};
@@ -0,0 +1,137 @@
+#include "Memory.h"
+#include <algorithm>
+#include <cstring>
+
+// A table or page still shared with a copy is copied before it is written;
+// once it is ours alone it is written in place.
+Memory::Table& Memory::ownTable(uint64_t t) {
+    if (t >= dir.size()) dir.resize(t + 1);
+    std::shared_ptr<Table>& table = dir[t];
+    if (!table) table = std::make_shared<Table>();
+    else if (table.use_count() > 1) table = std::make_shared<Table>(*table);
+    return *table;
+}
+
+Memory::Page& Memory::pageFor(uint64_t p) {
+    std::shared_ptr<Page>& slot = ownTable(p >> TABLE_BITS)[p & ((uint64_t(1) << TABLE_BITS) - 1)];
+    if (!slot) slot = std::make_shared<Page>();
+    else if (slot.use_count() > 1) slot = std::make_shared<Page>(*slot);
+    return *slot;
+}
+
+int32_t Memory::loadPaged(uint64_t addr) const {
+    const Page* p = page(addr >> PAGE_BITS);
+    return p ? p->cells[addr & (PAGE_CELLS - 1)] : 0;
+}
+
+void Memory::storePaged(uint64_t addr, int32_t value) {
+    pageFor(addr >> PAGE_BITS).cells[addr & (PAGE_CELLS - 1)] = value;
+}
+
+const int32_t* Memory::readSpan(uint64_t addr, uint64_t& n) const {
+    if (!paged()) return flatCells.data() + addr;
+    n = std::min(n, PAGE_CELLS - (addr & (PAGE_CELLS - 1)));
+    const Page* p = page(addr >> PAGE_BITS);
+    return p ? p->cells + (addr & (PAGE_CELLS - 1)) : nullptr;
+}
+
+int32_t* Memory::writeSpan(uint64_t addr, uint64_t& n) {
+    if (!paged()) return flatCells.data() + addr;
+    n = std::min(n, PAGE_CELLS - (addr & (PAGE_CELLS - 1)));
+    return pageFor(addr >> PAGE_BITS).cells + (addr & (PAGE_CELLS - 1));
+}
+
+const int32_t* Memory::pageCells(uint64_t p) const {
+    if (!paged()) return flatCells.data() + p * PAGE_CELLS;
+    const Page* pg = page(p);
+    return pg ? pg->cells : nullptr;
+}
+
+size_t Memory::pagesInUse() const {
+    if (!paged()) return size_t((cells + PAGE_CELLS - 1) / PAGE_CELLS);
+    size_t n = 0;
+    for (const auto& t : dir)
+        if (t)
+            for (const auto& pg : *t) n += pg != nullptr;
+    return n;
+}
+
+void Memory::resize(uint64_t newCells) {
+    newCells = std::min(newCells, MAX_CELLS);
+    if (!paged() && newCells <= FLAT_LIMIT) {
+        flatCells.resize(newCells, 0);
+        cells = newCells;
+        return;
+    }
+    if (paged() && newCells > FLAT_LIMIT) {
+        // drop pages past the new end; a partial last page is cleared above it
+        uint64_t pages = (newCells + PAGE_CELLS - 1) / PAGE_CELLS;
+        if (newCells < cells) {
+            for (uint64_t p = pages; p * PAGE_CELLS < cells; ++p)
+                if (page(p)) ownTable(p >> TABLE_BITS)[p & ((uint64_t(1) << TABLE_BITS) - 1)].reset();
+            if (newCells % PAGE_CELLS && page(newCells >> PAGE_BITS)) {
+                Page& last = pageFor(newCells >> PAGE_BITS);
+                uint64_t keep = newCells % PAGE_CELLS;
+                std::memset(last.cells + keep, 0, (PAGE_CELLS - keep) * sizeof(int32_t));
+            }
+        }
+        cells = newCells;
+        return;
+    }
+
+    // crossing FLAT_LIMIT: rebuild in the other layout
+    Memory next;
+    next.cells = newCells;
+    next.pagedLayout = newCells > FLAT_LIMIT;
+    if (!next.pagedLayout) next.flatCells.assign(newCells, 0);
+    forEachNonZero([&](uint64_t addr, int32_t v) {
+        if (addr < newCells) next.store(addr, v);
+    });
+    *this = std::move(next);
+}
+
+Memory Memory::snapshot() {
+    if (!paged() && cells > PAGE_CELLS) {
+        Memory next;
+        next.cells = cells;
+        next.pagedLayout = true;
+        forEachNonZero([&](uint64_t addr, int32_t v) { next.store(addr, v); });
+        *this = std::move(next);
+    }
+    return *this;
+}
+
+void Memory::unpage() {
+    if (!paged() || cells > FLAT_LIMIT) return;
+    Memory next;
+    next.cells = cells;
+    next.flatCells.assign(cells, 0);
+    for (uint64_t p = 0; p * PAGE_CELLS < cells; ++p) {
+        const int32_t* c = pageCells(p);
+        if (c) std::copy(c, c + std::min(PAGE_CELLS, cells - p * PAGE_CELLS), next.flatCells.begin() + p * PAGE_CELLS);
+    }
+    *this = std::move(next);
+}
+
+void Memory::clear() {
+    std::fill(flatCells.begin(), flatCells.end(), 0);
+    dir.clear();
+}
+
+bool Memory::firstDifference(const Memory& other, uint64_t& addr) const {
+    const uint64_t n = std::min(cells, other.cells);
+    for (uint64_t p = 0; p * PAGE_CELLS < n; ++p) {
+        const int32_t* a = pageCells(p);
+        const int32_t* b = other.pageCells(p);
+        if (!a && !b) continue;
+        uint64_t len = std::min<uint64_t>(PAGE_CELLS, n - p * PAGE_CELLS);
+        for (uint64_t i = 0; i < len; ++i) {
+            int32_t x = a ? a[i] : 0, y = b ? b[i] : 0;
+            if (x != y) {
+                addr = p * PAGE_CELLS + i;
+                return true;
+            }
+        }
+    }
+    return false;
+}
@@ -0,0 +1,102 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// VM memory: int32 cells at addresses 0 .. size()-1. Up to FLAT_LIMIT
+// cells it is one preallocated flat array that the interpreter and the JIT
+// index directly. Larger memories are split into 4 KiB pages that are only
+// allocated when first written, so a big, mostly empty address space costs
+// just the pages in use; reading a page that was never written gives 0.
+// Copies share pages: a copy (see snapshot()) costs a pointer per 2048
+// pages, and either side copies a page the first time it writes to it.
+// Addresses are not checked here: Program::load has already proved every
+// address an instruction can use is below the program's memory size.
+class Memory {
+public:
+    static constexpr uint64_t FLAT_LIMIT = uint64_t(1) << 20;   // cells (4 MiB)
+    static constexpr uint64_t MAX_CELLS = uint64_t(1) << 31;    // addresses are non-negative int32
+    static constexpr int PAGE_BITS = 10;
+    static constexpr uint64_t PAGE_CELLS = uint64_t(1) << PAGE_BITS;  // 4 KiB
+
+    explicit Memory(uint64_t cells = 0) { resize(cells); }
+
+    uint64_t size() const { return cells; }
+    int32_t* flat() { return flatCells.empty() ? nullptr : flatCells.data(); }  // null when paged
+    bool paged() const { return pagedLayout; }
+    size_t pagesInUse() const;  // allocated pages (paged), or the flat array's pages
+
+    int32_t load(uint64_t addr) const {
+        if (!paged()) return flatCells[addr];
+        const Page* p = page(addr >> PAGE_BITS);
+        return p ? p->cells[addr & (PAGE_CELLS - 1)] : 0;
+    }
+    void store(uint64_t addr, int32_t value) {
+        if (!paged()) flatCells[addr] = value;
+        else pageFor(addr >> PAGE_BITS).cells[addr & (PAGE_CELLS - 1)] = value;
+    }
+
+    // the paged halves of load() and store(), kept out of line so the
+    // interpreter's flat path stays small
+    int32_t loadPaged(uint64_t addr) const;
+    void storePaged(uint64_t addr, int32_t value);
+
+    // The block ops' view (see Vector.h): the cells from `addr` on, as many
+    // as are contiguous (to the end of its page, when paged), at most `n`;
+    // `n` is cut to that. readSpan gives null for a page never written,
+    // whose cells are all 0; writeSpan allocates or unshares it.
+    const int32_t* readSpan(uint64_t addr, uint64_t& n) const;
+    int32_t* writeSpan(uint64_t addr, uint64_t& n);
+
+    // Changes the size, keeping every cell below the new size; switches
+    // between flat and paged as the size crosses FLAT_LIMIT.
+    void resize(uint64_t newCells);
+    void clear();  // every cell back to 0
+
+    // A copy sharing every page with this memory. A flat memory larger than
+    // one page is switched to pages first, so this never copies more than
+    // one page of cells; until unpage() it then has no flat() array, which
+    // the interpreter's flat path and the JIT's memory ops need.
+    Memory snapshot();
+    // Back to one flat array if paged and no larger than FLAT_LIMIT: every
+    // cell is copied out, and copies keep the pages.
+    void unpage();
+
+    // f(address, value) for every non-zero cell, in address order.
+    template <class F>
+    void forEachNonZero(F f) const {
+        for (uint64_t p = 0; p * PAGE_CELLS < cells; ++p) {
+            const int32_t* c = pageCells(p);
+            if (!c) continue;
+            uint64_t n = std::min<uint64_t>(PAGE_CELLS, cells - p * PAGE_CELLS);
+            for (uint64_t i = 0; i < n; ++i)
+                if (c[i]) f(p * PAGE_CELLS + i, c[i]);
+        }
+    }
+
+    // First address below min(size(), other.size()) where the two differ.
+    bool firstDifference(const Memory& other, uint64_t& addr) const;
+
+private:
+    static constexpr int TABLE_BITS = 11;  // pages per second-level table
+    struct Page { int32_t cells[PAGE_CELLS] = {}; };
+    using Table = std::array<std::shared_ptr<Page>, size_t(1) << TABLE_BITS>;
+
+    const Page* page(uint64_t p) const {
+        uint64_t t = p >> TABLE_BITS;
+        if (t >= dir.size() || !dir[t]) return nullptr;
+        return (*dir[t])[p & ((uint64_t(1) << TABLE_BITS) - 1)].get();
+    }
+    Page* page(uint64_t p) { return const_cast<Page*>(static_cast<const Memory*>(this)->page(p)); }
+    Page& pageFor(uint64_t p);     // writable: allocated, or unshared from copies
+    Table& ownTable(uint64_t t);   // writable second-level table
+    const int32_t* pageCells(uint64_t p) const;  // null: all zero
+
+    uint64_t cells = 0;
+    bool pagedLayout = false;
+    std::vector<int32_t> flatCells;          // flat memories
+    std::vector<std::shared_ptr<Table>> dir;  // paged memories: tables made on demand
+};
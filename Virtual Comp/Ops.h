@@ -0,0 +1,129 @@
+#pragma once
+#include <cstdint>
+
+// Bytecode opcodes as written by the assembler (one byte per instruction).
+enum Opcodes {
+    OP_PUSH     = 0x01,
+    OP_MOV      = 0x02,
+    OP_ADDR     = 0x03,
+    OP_SUBR     = 0x04,
+    OP_LOADR    = 0x05,
+    OP_STORER   = 0x06,
+    OP_PRINT    = 0x07,
+    OP_PRINTR   = 0x08,
+    OP_CMP      = 0x09,
+    OP_JEQ      = 0x0A,
+    OP_JNE      = 0x0B,
+    OP_JGT      = 0x0C,
+    OP_JLT      = 0x0D,
+    OP_LOADM    = 0x0E,
+    OP_STOREM   = 0x0F,
+    OP_LOADMR   = 0x10,
+    OP_STOREMR  = 0x11,
+    OP_DECR     = 0x12,
+    OP_CPRINT   = 0x13,
+    OP_CEASE    = 0x14,
+    // stack ops: the arithmetic pops b, then a, and pushes the result
+    OP_ADD      = 0x16,  // a + b
+    OP_SUB      = 0x17,  // a - b
+    OP_MUL      = 0x18,  // a * b
+    OP_DUP      = 0x19,  // push the top again
+    // text-mode instructions (see compileText); jump targets in a
+    OP_HOP      = 0x15,  // jump
+    OP_HZ       = 0x1A,  // pop; jump if it was zero
+    OP_HNZ      = 0x1B,  // pop; jump if it was not zero
+    OP_LOAD     = 0x1C,  // COUNTER = a
+    OP_CHNZ     = 0x1D,  // jump if COUNTER is not zero
+    OP_SETM     = 0x1E,  // memory[a] = b
+    OP_MEMDUMP  = 0x1F,  // print every non-zero cell
+    // block memory ops over c cells (see Vector.h): a and b are the
+    // destination and source, a range's first address or a register
+    OP_VADD     = 0x20,  // MEM[a+i] += MEM[b+i]
+    OP_VFILL    = 0x21,  // MEM[a+i] = Rb
+    OP_VCOPY    = 0x22,  // MEM[a+i] = MEM[b+i], as if through a temporary
+    OP_VSUM     = 0x23,  // Ra = sum of MEM[b+i]
+    OP_VCNT     = 0x24,  // Ra = how many MEM[b+i] equal Ra
+    OP_VMIN     = 0x25,  // Ra = least MEM[b+i]
+    OP_VMAX     = 0x26,  // Ra = greatest MEM[b+i]
+    // register ALU, Ra = Rb op Rc (ADDR and SUBR above). Arithmetic wraps;
+    // shift counts are taken mod 32; DIVR/MODR by zero stop the program
+    OP_MULR     = 0x27,
+    OP_DIVR     = 0x28,  // truncates toward zero
+    OP_MODR     = 0x29,  // sign of Rb
+    OP_ANDR     = 0x2A,
+    OP_ORR      = 0x2B,
+    OP_XORR     = 0x2C,
+    OP_SHLR     = 0x2D,
+    OP_SHRR     = 0x2E,  // logical
+    OP_SARR     = 0x2F,  // arithmetic
+    // immediate ALU, Ra = Rb op c, c any 32-bit value (DIVI/MODI: not 0)
+    OP_ADDI     = 0x30,
+    OP_SUBI     = 0x31,
+    OP_MULI     = 0x32,
+    OP_DIVI     = 0x33,
+    OP_MODI     = 0x34,
+    OP_ANDI     = 0x35,
+    OP_ORI      = 0x36,
+    OP_XORI     = 0x37,
+    OP_SHLI     = 0x38,
+    OP_SHRI     = 0x39,
+    OP_SARI     = 0x3A,
+    OP_INC      = 0x3B,  // a += 1; a is a register or COUNTER
+    OP_DEC      = 0x3C,  // a -= 1; a is a register or COUNTER
+    OP_CMPI     = 0x3D,  // set flags comparing a (register or COUNTER) with b
+    // subroutines: return addresses go on their own stack (VM_CALL_DEPTH),
+    // never the operand stack
+    OP_CALL     = 0x3E,  // push the next line, jump to a
+    OP_RET      = 0x3F   // pop a return address and resume there
+};
+
+// Internal opcodes produced by VirtualMachine::decode(). Register/COUNTER forms of CMP are
+// split out, CEASE becomes a jump to the trailing HALT op.
+enum DecodedOpcodes : uint8_t {
+    X_PUSH, X_MOV, X_ADDR, X_LOADR, X_STORER, X_PRINT, X_PRINTR,
+    X_CMP_RR, X_CMP_CR, X_CMP_RC, X_CMP_CC,
+    X_JEQ, X_JNE, X_JGT, X_JLT, X_JMP,
+    X_LOADM, X_STOREM, X_LOADMR, X_STOREMR,
+    X_DECR, X_CPRINT, X_HALT,
+    X_ADD, X_SUB, X_MUL, X_DUP, X_JZ, X_JNZ,                 // stack arithmetic, stack hops
+    X_LOADC, X_CJNZ, X_SETM, X_MEMDUMP,                       // text-mode counter/memory ops
+    X_SUBR,
+    X_VADD, X_VFILL, X_VCOPY, X_VSUM, X_VCNT, X_VMIN, X_VMAX,  // block memory ops
+    X_MULR, X_DIVR, X_MODR, X_ANDR, X_ORR, X_XORR, X_SHLR, X_SHRR, X_SARR,      // Ra = Rb op Rc
+    X_ADDI, X_MULI, X_DIVI, X_MODI, X_ANDI, X_ORI, X_XORI, X_SHLI, X_SHRI, X_SARI,  // Ra = Rb op c; SUBI is ADDI -c
+    X_INC, X_DEC, X_INCC,                                     // DEC COUNTER is DECR
+    X_CMP_RI, X_CMP_CI,                                       // CMPI Ra b, CMPI COUNTER b
+    X_CALL, X_RET,
+    // superinstructions built by fuse(); jump target in c
+    X_CMPJ_RR_EQ, X_CMPJ_RR_NE, X_CMPJ_RR_GT, X_CMPJ_RR_LT,   // CMP Ra Rb; Jcc
+    X_CMPJ_CR_EQ, X_CMPJ_CR_NE, X_CMPJ_CR_GT, X_CMPJ_CR_LT,   // CMP COUNTER Rb; Jcc
+    X_DCMPJ_EQ, X_DCMPJ_NE, X_DCMPJ_GT, X_DCMPJ_LT,           // DECR; CMP COUNTER Rb; Jcc
+    X_CMPJ_RI_EQ, X_CMPJ_RI_NE, X_CMPJ_RI_GT, X_CMPJ_RI_LT,   // CMPI Ra b; Jcc
+    X_CMPJ_CI_EQ, X_CMPJ_CI_NE, X_CMPJ_CI_GT, X_CMPJ_CI_LT,   // CMPI COUNTER b; Jcc
+    X_DCMPJI_EQ, X_DCMPJI_NE, X_DCMPJI_GT, X_DCMPJI_LT,       // DECR; CMPI COUNTER b; Jcc
+    X_MOV2,                                                   // MOV Ra b; MOV Rc d
+    // stack ops with no depth test, in blocks where Program::proveStack()
+    // showed the stack can neither underflow nor outgrow its capacity
+    // (`fused` only)
+    X_PUSH_U, X_LOADR_U, X_STORER_U, X_PRINT_U, X_LOADM_U, X_STOREM_U,
+    X_ADD_U, X_SUB_U, X_MUL_U, X_DUP_U, X_JZ_U, X_JNZ_U,
+    X_COUNT
+};
+
+// Op::flags bits. The interpreter returns before running an op whose
+// flags intersect its stop mask.
+enum OpFlags : uint8_t {
+    OPF_LEADER = 0x01,  // first op of a basic block
+    OPF_BREAK  = 0x02,  // stepper: a breakpoint's line (VirtualMachine's debug copy only)
+    OPF_WATCH  = 0x04,  // stepper: may write a watched location (debug copy only)
+    OPF_STEP   = 0x80,  // set on every op: stop mask for single-stepping
+};
+
+// Pre-decoded instruction. Operands are already validated: register/COUNTER
+// forms are split into separate opcodes and jump targets are op indices.
+struct Op {
+    const void* handler = nullptr;  // threaded-code label (computed-goto builds)
+    uint8_t code = 0;               // internal opcode (see DecodedOpcodes)
+    uint8_t flags = OPF_STEP;       // OpFlags
+    int32_t a = 0, b = 0, c = 0, d = 0;
+};
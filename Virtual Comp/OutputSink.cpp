@@ -0,0 +1,63 @@
+#include "OutputSink.h"
+#include <charconv>
+#include <cstring>
+
+OutputSink& OutputSink::operator<<(const char* s) {
+    write(s, std::strlen(s));
+    return *this;
+}
+
+OutputSink& OutputSink::operator<<(long long v) {
+    char tmp[24];
+    auto res = std::to_chars(tmp, tmp + sizeof(tmp), v);
+    write(tmp, res.ptr - tmp);
+    return *this;
+}
+
+
+BufferedSink::BufferedSink(std::ostream& os, size_t capacity)
+    : os(os), buf(capacity ? capacity : 1) {}
+
+void BufferedSink::write(const char* data, size_t len) {
+    if (used + len > buf.size()) {
+        flush();
+        if (len > buf.size()) {  // too big to buffer: pass straight through
+            os.write(data, len);
+            return;
+        }
+    }
+    std::memcpy(buf.data() + used, data, len);
+    used += len;
+}
+
+void BufferedSink::flush() {
+    if (used == 0) return;
+    os.write(buf.data(), used);
+    os.flush();
+    used = 0;
+}
+
+
+void RingBufferSink::write(const char* data, size_t len) {
+    const size_t cap = buf.size();
+    if (cap == 0) return;
+    if (len > cap) {  // only the tail can survive
+        data += len - cap;
+        written += len - cap;
+        len = cap;
+    }
+    size_t pos = written % cap;
+    size_t first = std::min(len, cap - pos);
+    std::memcpy(buf.data() + pos, data, first);
+    std::memcpy(buf.data(), data + first, len - first);
+    written += len;
+}
+
+std::string RingBufferSink::str() const {
+    const size_t cap = buf.size();
+    if (written <= cap) return std::string(buf.data(), written);
+    size_t pos = written % cap;
+    std::string s(buf.data() + pos, cap - pos);
+    s.append(buf.data(), pos);
+    return s;
+}
@@ -0,0 +1,73 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Where the VM's program output goes. Handlers format through the
+// operator<< helpers below instead of writing to std::cout, so output is
+// never flushed per instruction and can be redirected per machine.
+class OutputSink {
+public:
+    virtual ~OutputSink() = default;
+    virtual void write(const char* data, size_t len) = 0;
+    virtual void flush() {}
+
+    OutputSink& operator<<(const char* s);
+    OutputSink& operator<<(const std::string& s) { write(s.data(), s.size()); return *this; }
+    OutputSink& operator<<(char c) { write(&c, 1); return *this; }
+    OutputSink& operator<<(bool b) { return *this << (b ? '1' : '0'); }  // matches std::cout
+    OutputSink& operator<<(int v) { return *this << (long long)v; }
+    OutputSink& operator<<(long long v);
+};
+
+// Collects output in a large buffer and hands it to an ostream in big
+// chunks, on flush() or when the buffer fills.
+class BufferedSink : public OutputSink {
+public:
+    explicit BufferedSink(std::ostream& os = std::cout, size_t capacity = 1 << 16);
+    ~BufferedSink() override { flush(); }
+    void write(const char* data, size_t len) override;
+    void flush() override;
+
+private:
+    std::ostream& os;
+    std::vector<char> buf;
+    size_t used = 0;
+};
+
+// Keeps the most recent `capacity` bytes in memory; meant for tests and
+// for comparing runs.
+class RingBufferSink : public OutputSink {
+public:
+    explicit RingBufferSink(size_t capacity = 1 << 16) : buf(capacity) {}
+    void write(const char* data, size_t len) override;
+
+    std::string str() const;                  // retained output, oldest first
+    uint64_t total() const { return written; }  // bytes ever written
+    void clear() { written = 0; }
+
+private:
+    std::vector<char> buf;
+    uint64_t written = 0;
+};
+
+// Keeps everything written, e.g. one batch job's output until its turn
+// to be printed.
+class StringSink : public OutputSink {
+public:
+    void write(const char* data, size_t len) override { buf.append(data, len); }
+
+    const std::string& str() const { return buf; }
+    void clear() { buf.clear(); }
+
+private:
+    std::string buf;
+};
+
+// Discards everything.
+class NullSink : public OutputSink {
+public:
+    void write(const char*, size_t) override {}
+};
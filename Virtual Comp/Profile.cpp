@@ -0,0 +1,214 @@
+#include "Profile.h"
+#include <algorithm>
+#include <cstdio>
+#include <iomanip>
+#include <iostream>
+#include <numeric>
+
+namespace {
+
+bool isBranch(uint8_t opcode) {
+    return (opcode >= OP_JEQ && opcode <= OP_JLT) || opcode == OP_HZ || opcode == OP_HNZ || opcode == OP_CHNZ;
+}
+
+// A loop: lines [from, to] repeated by a taken backward jump at `to`.
+struct Loop {
+    int from, to;
+    uint64_t iterations, instructions;
+};
+
+std::vector<Loop> findLoops(const Profile& p, const Program& program) {
+    std::vector<Loop> loops;
+    for (int i = 0; i < program.size(); ++i) {
+        const Op& op = program.ops[i];
+        if (!isBranch(program.bytecode[i].opcode) || op.a > i || !p.taken[i]) continue;
+        uint64_t body = std::accumulate(p.hits.begin() + op.a, p.hits.begin() + i + 1, uint64_t(0));
+        loops.push_back({op.a, i, p.taken[i], body});
+    }
+    std::stable_sort(loops.begin(), loops.end(),
+                     [](const Loop& x, const Loop& y) { return x.instructions > y.instructions; });
+    return loops;
+}
+
+// Per class: its count, and its share of the run's time. A class's mean
+// sampled time (clock cost taken off) times its count estimates its time;
+// the estimates are then scaled to add up to the measured run.
+struct ClassTotals {
+    uint64_t count[Profile::CLASS_COUNT] = {};
+    uint64_t samples[Profile::CLASS_COUNT] = {};
+    double nanos[Profile::CLASS_COUNT] = {};
+
+    double nsPerInstr(int c) const { return count[c] ? nanos[c] / count[c] : 0.0; }
+};
+
+ClassTotals classTotals(const Profile& p, const Program& program) {
+    ClassTotals t;
+    double sampled[Profile::CLASS_COUNT] = {};
+    for (int i = 0; i < program.size(); ++i) {
+        int c = Profile::classOf(program.bytecode[i].opcode);
+        t.count[c] += p.hits[i];
+        t.samples[c] += p.samples[i];
+        sampled[c] += std::max(0.0, p.sampleNanos[i] - p.clockNanos * p.samples[i]);
+    }
+    double estimated = 0;
+    for (int c = 0; c < Profile::CLASS_COUNT; ++c) {
+        if (t.samples[c]) t.nanos[c] = sampled[c] / t.samples[c] * t.count[c];
+        estimated += t.nanos[c];
+    }
+    if (estimated > 0)
+        for (double& n : t.nanos) n *= p.seconds * 1e9 / estimated;
+    return t;
+}
+
+// per bytecode opcode, most executed first
+std::vector<std::pair<uint8_t, uint64_t>> opcodeCounts(const Profile& p, const Program& program) {
+    uint64_t count[256] = {};
+    for (int i = 0; i < program.size(); ++i) count[program.bytecode[i].opcode] += p.hits[i];
+    std::vector<std::pair<uint8_t, uint64_t>> out;
+    for (int op = 0; op < 256; ++op)
+        if (count[op]) out.push_back({uint8_t(op), count[op]});
+    std::stable_sort(out.begin(), out.end(), [](const auto& x, const auto& y) { return x.second > y.second; });
+    return out;
+}
+
+std::string jsonString(const std::string& s) {
+    std::string out = "\"";
+    for (char c : s) {
+        if (c == '"' || c == '\\') out += '\\';
+        if ((unsigned char)c < 0x20) {
+            char esc[8];
+            std::snprintf(esc, sizeof(esc), "\\u%04x", c);
+            out += esc;
+        } else {
+            out += c;
+        }
+    }
+    return out + "\"";
+}
+
+}  // namespace
+
+const char* Profile::className(int c) {
+    static const char* const names[CLASS_COUNT] = {"arith", "stack", "memory", "compare", "branch", "io"};
+    return c >= 0 && c < CLASS_COUNT ? names[c] : "?";
+}
+
+int Profile::classOf(uint8_t opcode) {
+    switch (opcode) {
+        case OP_PUSH: case OP_LOADR: case OP_STORER: case OP_DUP: return STACK;
+        case OP_LOADM: case OP_STOREM: case OP_LOADMR: case OP_STOREMR: case OP_SETM:
+        case OP_VADD: case OP_VFILL: case OP_VCOPY: case OP_VSUM: case OP_VCNT: case OP_VMIN: case OP_VMAX:
+            return MEMORY;
+        case OP_CMP: case OP_CMPI: return COMPARE;
+        case OP_JEQ: case OP_JNE: case OP_JGT: case OP_JLT: case OP_CEASE:
+        case OP_HOP: case OP_HZ: case OP_HNZ: case OP_CHNZ: case OP_CALL: case OP_RET: return BRANCH;
+        case OP_PRINT: case OP_PRINTR: case OP_CPRINT: case OP_MEMDUMP: return IO;
+        default: return ARITH;  // MOV, the register and immediate ALU ops, INC, DEC, DECR, ADD, SUB, MUL, LOAD
+    }
+}
+
+void Profile::reset(size_t lines) {
+    hits.assign(lines, 0);
+    taken.assign(lines, 0);
+    sampleNanos.assign(lines, 0);
+    samples.assign(lines, 0);
+    instructions = 0;
+    seconds = 0;
+}
+
+void Profile::report(std::ostream& os, const Program& program) const {
+    const double total = instructions ? double(instructions) : 1.0;
+    auto share = [&](uint64_t n) { return 100.0 * n / total; };
+    os << std::fixed << std::setprecision(1);
+
+    os << "[PROFILE] " << instructions << " instructions in " << seconds * 1000.0 << " ms ("
+       << (seconds > 0 ? instructions / seconds / 1e6 : 0.0) << " M instr/s while profiling)\n";
+
+    os << "[PROFILE] by opcode:\n";
+    for (const auto& oc : opcodeCounts(*this, program))
+        os << "[PROFILE]   " << std::left << std::setw(8) << Program::opcodeName(oc.first) << std::right
+           << std::setw(14) << oc.second << std::setw(7) << share(oc.second) << "%\n";
+
+    os << "[PROFILE] by class (time sampled 1 in " << SAMPLE_EVERY << "):\n";
+    ClassTotals ct = classTotals(*this, program);
+    std::vector<int> classes(CLASS_COUNT);
+    std::iota(classes.begin(), classes.end(), 0);
+    std::stable_sort(classes.begin(), classes.end(), [&](int x, int y) {
+        return ct.nanos[x] > ct.nanos[y];
+    });
+    for (int c : classes) {
+        if (!ct.count[c]) continue;
+        os << "[PROFILE]   " << std::left << std::setw(8) << className(c) << std::right
+           << std::setw(14) << ct.count[c] << std::setw(7) << share(ct.count[c]) << "%   ~"
+           << ct.nsPerInstr(c) << " ns/instr, ~" << ct.nanos[c] / 1e6 << " ms\n";
+    }
+
+    os << "[PROFILE] hottest lines:\n";
+    std::vector<int> lines;
+    for (int i = 0; i < program.size(); ++i)
+        if (hits[i]) lines.push_back(i);
+    std::stable_sort(lines.begin(), lines.end(), [&](int x, int y) { return hits[x] > hits[y]; });
+    if (lines.size() > 20) lines.resize(20);
+    for (int i : lines)
+        os << "[PROFILE]   line " << std::left << std::setw(6) << i + 1 << std::setw(8)
+           << Program::opcodeName(program.bytecode[i].opcode) << std::right << std::setw(14) << hits[i]
+           << std::setw(7) << share(hits[i]) << "%\n";
+
+    bool any = false;
+    for (int i = 0; i < program.size(); ++i) {
+        if (!isBranch(program.bytecode[i].opcode) || !hits[i]) continue;
+        if (!any) os << "[PROFILE] branches:\n";
+        any = true;
+        os << "[PROFILE]   line " << i + 1 << " " << Program::opcodeName(program.bytecode[i].opcode)
+           << " -> " << program.ops[i].a + 1 << ": taken " << taken[i] << ", not taken " << hits[i] - taken[i]
+           << " (" << 100.0 * taken[i] / hits[i] << "% taken)\n";
+    }
+
+    std::vector<Loop> loops = findLoops(*this, program);
+    if (!loops.empty()) os << "[PROFILE] hot loops:\n";
+    for (size_t k = 0; k < loops.size() && k < 10; ++k) {
+        const Loop& l = loops[k];
+        os << "[PROFILE]   lines " << l.from + 1 << "-" << l.to + 1 << ": " << l.iterations
+           << " iterations, " << l.instructions << " instructions (" << share(l.instructions) << "%)\n";
+    }
+    os << std::defaultfloat;
+}
+
+void Profile::writeJson(std::ostream& os, const Program& program, const std::string& name) const {
+    os << "{\n  \"program\": " << jsonString(name) << ",\n  \"instructions\": " << instructions
+       << ",\n  \"seconds\": " << seconds << ",\n  \"sampleEvery\": " << SAMPLE_EVERY << ",\n";
+
+    os << "  \"opcodes\": [";
+    const char* sep = "\n";
+    for (const auto& oc : opcodeCounts(*this, program)) {
+        os << sep << "    {\"opcode\": \"" << Program::opcodeName(oc.first) << "\", \"count\": " << oc.second << "}";
+        sep = ",\n";
+    }
+    os << "\n  ],\n  \"classes\": [";
+    ClassTotals ct = classTotals(*this, program);
+    sep = "\n";
+    for (int c = 0; c < CLASS_COUNT; ++c) {
+        os << sep << "    {\"class\": \"" << className(c) << "\", \"count\": " << ct.count[c]
+           << ", \"samples\": " << ct.samples[c] << ", \"nsPerInstr\": " << ct.nsPerInstr(c)
+           << ", \"seconds\": " << ct.nanos[c] / 1e9 << "}";
+        sep = ",\n";
+    }
+    os << "\n  ],\n  \"lines\": [";
+    sep = "\n";
+    for (int i = 0; i < program.size(); ++i) {
+        uint8_t opcode = program.bytecode[i].opcode;
+        os << sep << "    {\"line\": " << i + 1 << ", \"opcode\": \"" << Program::opcodeName(opcode)
+           << "\", \"hits\": " << hits[i];
+        if (isBranch(opcode)) os << ", \"target\": " << program.ops[i].a + 1 << ", \"taken\": " << taken[i];
+        os << "}";
+        sep = ",\n";
+    }
+    os << "\n  ],\n  \"loops\": [";
+    sep = "\n";
+    for (const Loop& l : findLoops(*this, program)) {
+        os << sep << "    {\"from\": " << l.from + 1 << ", \"to\": " << l.to + 1 << ", \"iterations\": "
+           << l.iterations << ", \"instructions\": " << l.instructions << "}";
+        sep = ",\n";
+    }
+    os << "\n  ]\n}\n";
+}
@@ -0,0 +1,36 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <iosfwd>
+#include <string>
+#include <vector>
+#include "Program.h"
+
+// What one profiled runBytecode() did (see VirtualMachine::setProfiling).
+// Counts are exact and kept per line; opcode and class totals are derived
+// from them. Times are sampled: about one instruction in SAMPLE_EVERY is
+// timed on the wall clock, and the run's time is split between opcode
+// classes by mean sampled time times count.
+struct Profile {
+    static constexpr int SAMPLE_EVERY = 64;
+
+    enum OpClass { ARITH, STACK, MEMORY, COMPARE, BRANCH, IO, CLASS_COUNT };
+    static const char* className(int c);
+    static int classOf(uint8_t opcode);  // bytecode opcode -> OpClass
+
+    std::vector<uint64_t> hits;          // per line: times run
+    std::vector<uint64_t> taken;         // per line: jumps taken
+    std::vector<uint64_t> sampleNanos;   // per line: sampled time
+    std::vector<uint64_t> samples;       // per line: times sampled
+    uint64_t instructions = 0;
+    double seconds = 0;                  // the whole run, profiling included
+    double clockNanos = 0;               // cost of one clock read, taken off every sample
+
+    void reset(size_t lines);
+
+    // Sorted report: opcodes, classes, hottest lines, branches and hot
+    // loops (lines a taken backward jump repeats).
+    void report(std::ostream& os, const Program& program) const;
+    // The same data as one JSON object.
+    void writeJson(std::ostream& os, const Program& program, const std::string& name) const;
+};
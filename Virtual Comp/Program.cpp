@@ -0,0 +1,849 @@
+#include "Program.h"
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include "Memory.h"
+#include "VirtualMachine.h"
+
+// Files are mapped where mmap exists; elsewhere they are read in one go.
+#if defined(__unix__) || defined(__APPLE__)
+#define VM_MMAP 1
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#else
+#define VM_MMAP 0
+#endif
+
+static void report(std::string* error, const std::string& msg) {
+    if (error) *error = msg;
+    else std::cerr << msg << "\n";
+}
+
+// Reserves room for a large op stream and, where supported, asks for huge
+// pages for it: a multi-megabyte program otherwise spends most of its
+// decode time faulting in 4 KiB pages.
+template <class T>
+static void reserveLarge(std::vector<T>& v, size_t n) {
+    v.reserve(n);
+#if VM_MMAP && defined(MADV_HUGEPAGE)
+    const uintptr_t huge = 2u << 20;
+    uintptr_t begin = (reinterpret_cast<uintptr_t>(v.data()) + huge - 1) & ~(huge - 1);
+    uintptr_t end = reinterpret_cast<uintptr_t>(v.data() + n) & ~(huge - 1);
+    if (end > begin) madvise(reinterpret_cast<void*>(begin), end - begin, MADV_HUGEPAGE);
+#endif
+}
+
+Program::~Program() { release(); }
+
+// Frees the file image once nothing points into it: after a legacy file
+// has been widened into `owned`, or when the program is destroyed.
+void Program::release() {
+#if VM_MMAP
+    if (mapping) munmap(mapping, mappingSize);
+#endif
+    mapping = nullptr;
+    mappingSize = 0;
+    std::vector<uint32_t>().swap(image);
+}
+
+// Maps regular files read-only; a container's code section is decoded
+// straight from the mapping and never copied. Anything that can't be mapped
+// (pipes, empty files, no mmap) falls back to fromStream().
+std::shared_ptr<const Program> Program::load(const std::string& filename, std::string* error) {
+    if (filename == "-") return fromStream(std::cin, "<stdin>", error);
+
+#if VM_MMAP
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+        report(error, "Could not open bytecode file " + filename);
+        return nullptr;
+    }
+    struct stat st;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size >= (off_t)sizeof(LegacyRecord)) {
+        void* base = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (base != MAP_FAILED) {
+            madvise(base, st.st_size, MADV_SEQUENTIAL);
+            std::shared_ptr<Program> p(new Program());
+            p->mapping = base;
+            p->mappingSize = st.st_size;
+            return finish(std::move(p), filename, error);
+        }
+    } else {
+        close(fd);
+    }
+#endif
+
+    std::ifstream file(filename, std::ios::binary);
+    if (!file) {
+        report(error, "Could not open bytecode file " + filename);
+        return nullptr;
+    }
+    return fromStream(file, filename, error);
+}
+
+// One bulk read: the whole stream is pulled in large chunks, then parsed
+// in place.
+std::shared_ptr<const Program> Program::fromStream(std::istream& in, const std::string& name, std::string* error) {
+    std::shared_ptr<Program> p(new Program());
+    const size_t chunk = 1 << 20;
+    size_t have = 0;  // bytes read so far
+    for (;;) {
+        p->image.resize((have + chunk) / sizeof(uint32_t) + 1);
+        char* dst = reinterpret_cast<char*>(p->image.data()) + have;
+        size_t got = (size_t)in.rdbuf()->sgetn(dst, chunk);
+        have += got;
+        if (got < chunk) break;
+    }
+    p->image.resize((have + sizeof(uint32_t) - 1) / sizeof(uint32_t));
+    p->imageSize = have;
+    return finish(std::move(p), name, error);
+}
+
+// The buffer is copied once, so the caller may free it as soon as this
+// returns.
+std::shared_ptr<const Program> Program::fromMemory(const void* data, size_t size, const std::string& name,
+                                                   std::string* error) {
+    std::shared_ptr<Program> p(new Program());
+    p->image.resize((size + sizeof(uint32_t) - 1) / sizeof(uint32_t));
+    if (size) std::memcpy(p->image.data(), data, size);
+    p->imageSize = size;
+    return finish(std::move(p), name, error);
+}
+
+
+// --- container parsing ---
+// One pass over the file image. A container's code records are used where
+// they lie; legacy records are widened into `owned`, sized up front, and
+// the image is dropped.
+
+bool Program::parse(const void* bytes, size_t size, std::string& error) {
+    const uint8_t* base = static_cast<const uint8_t*>(bytes);
+    fileBytes = size;
+
+    if (size < sizeof(VMBC_MAGIC) || std::memcmp(base, VMBC_MAGIC, sizeof(VMBC_MAGIC)) != 0) {
+        const LegacyRecord* in = static_cast<const LegacyRecord*>(bytes);
+        const size_t n = size / sizeof(LegacyRecord);  // a trailing partial record is ignored
+        reserveLarge(owned, n);
+        owned.resize(n);
+        for (size_t i = 0; i < n; ++i) {
+            Instruction& out = owned[i];
+            out.opcode = in[i].opcode;
+            out.a = in[i].a; out.b = in[i].b; out.c = in[i].c;
+        }
+        bytecode.ptr = owned.data();
+        bytecode.n = n;
+        release();
+        return true;
+    }
+
+    ContainerHeader h;
+    if (size < sizeof(h)) {
+        error = "truncated container header";
+        return false;
+    }
+    std::memcpy(&h, base, sizeof(h));
+    if (h.version != VMBC_VERSION) {
+        error = "unsupported container version " + std::to_string(h.version);
+        return false;
+    }
+    if (h.headerSize < sizeof(h) || h.headerSize % alignof(Instruction) != 0) {
+        error = "bad container header size " + std::to_string(h.headerSize);
+        return false;
+    }
+    const uint64_t codeEnd = h.headerSize + uint64_t(h.codeCount) * sizeof(Instruction);
+    const uint64_t dataEnd = codeEnd + uint64_t(h.dataCount) * sizeof(int32_t);
+    const uint64_t symbolsEnd = dataEnd + h.symbolsSize;
+    if (symbolsEnd > size) {
+        error = "container is truncated (" + std::to_string(size) + " of " + std::to_string(symbolsEnd) + " bytes)";
+        return false;
+    }
+    if (h.memoryCells) {
+        if (h.memoryCells > Memory::MAX_CELLS) {
+            error = "memory size " + std::to_string(h.memoryCells) + " is too large";
+            return false;
+        }
+        memoryCells = h.memoryCells;
+    }
+    if (h.dataCount > memoryCells) {
+        error = "data section has " + std::to_string(h.dataCount) + " cells, more than the program's "
+              + std::to_string(memoryCells);
+        return false;
+    }
+
+    version = h.version;
+    text = h.flags & VMBC_FLAG_TEXT;
+    bytecode.ptr = reinterpret_cast<const Instruction*>(base + h.headerSize);
+    bytecode.n = h.codeCount;
+    data.resize(h.dataCount);
+    if (h.dataCount) std::memcpy(data.data(), base + codeEnd, h.dataCount * sizeof(int32_t));
+
+    for (uint64_t at = dataEnd; at < symbolsEnd; ) {
+        uint32_t entry[2];  // line, length
+        if (symbolsEnd - at < sizeof(entry)) {
+            error = "truncated symbol section";
+            return false;
+        }
+        std::memcpy(entry, base + at, sizeof(entry));
+        at += sizeof(entry);
+        if (symbolsEnd - at < entry[1]) {
+            error = "truncated symbol section";
+            return false;
+        }
+        if (entry[0] > h.codeCount) {  // a label may follow the last line, no further
+            error = "symbol line out of range (" + std::to_string(entry[0]) + " of "
+                  + std::to_string(h.codeCount) + " lines)";
+            return false;
+        }
+        symbols.push_back({std::string(reinterpret_cast<const char*>(base + at), entry[1]), (int)entry[0]});
+        at += entry[1];
+    }
+    return true;
+}
+
+// Parses the file image (the mapping, or `image`), then decodes, fuses and
+// threads its records.
+std::shared_ptr<const Program> Program::finish(std::shared_ptr<Program> p, const std::string& name,
+                                               std::string* error) {
+    std::string why;
+    bool ok = p->mapping ? p->parse(p->mapping, p->mappingSize, why) : p->parse(p->image.data(), p->imageSize, why);
+    if (!ok || !p->build(why)) {
+        report(error, "Invalid program " + name + ": " + why);
+        return nullptr;
+    }
+    return p;
+}
+
+bool Program::build(std::string& error) {
+    const void* const* labels = VirtualMachine::handlerTable();
+    if (!decode(error, labels)) return false;
+    fuse(labels);
+    findBlocks();
+    proveStack(labels);
+    return true;
+}
+
+const char* Program::opcodeName(uint8_t op) {
+    switch (op) {
+        case OP_PUSH: return "PUSH";
+        case OP_MOV: return "MOV";
+        case OP_ADDR: return "ADDR";
+        case OP_SUBR: return "SUBR";
+        case OP_LOADR: return "LOADR";
+        case OP_STORER: return "STORER";
+        case OP_PRINT: return "PRINT";
+        case OP_PRINTR: return "PRINTR";
+        case OP_CMP: return "CMP";
+        case OP_JEQ: return "JEQ";
+        case OP_JNE: return "JNE";
+        case OP_JGT: return "JGT";
+        case OP_JLT: return "JLT";
+        case OP_LOADM: return "LOADM";
+        case OP_STOREM: return "STOREM";
+        case OP_LOADMR: return "LOADMR";
+        case OP_STOREMR: return "STOREMR";
+        case OP_DECR: return "DECR";
+        case OP_CPRINT: return "CPRINT";
+        case OP_CEASE: return "CEASE";
+        case OP_HOP: return "HOP";
+        case OP_ADD: return "ADD";
+        case OP_SUB: return "SUB";
+        case OP_MUL: return "MUL";
+        case OP_DUP: return "DUP";
+        case OP_HZ: return "HZ";
+        case OP_HNZ: return "HNZ";
+        case OP_LOAD: return "LOAD";
+        case OP_CHNZ: return "CHNZ";
+        case OP_SETM: return "SETM";
+        case OP_MEMDUMP: return "MEMDUMP";
+        case OP_VADD: return "VADD";
+        case OP_VFILL: return "VFILL";
+        case OP_VCOPY: return "VCOPY";
+        case OP_VSUM: return "VSUM";
+        case OP_VCNT: return "VCNT";
+        case OP_VMIN: return "VMIN";
+        case OP_VMAX: return "VMAX";
+        case OP_MULR: return "MULR";
+        case OP_DIVR: return "DIVR";
+        case OP_MODR: return "MODR";
+        case OP_ANDR: return "ANDR";
+        case OP_ORR: return "ORR";
+        case OP_XORR: return "XORR";
+        case OP_SHLR: return "SHLR";
+        case OP_SHRR: return "SHRR";
+        case OP_SARR: return "SARR";
+        case OP_ADDI: return "ADDI";
+        case OP_SUBI: return "SUBI";
+        case OP_MULI: return "MULI";
+        case OP_DIVI: return "DIVI";
+        case OP_MODI: return "MODI";
+        case OP_ANDI: return "ANDI";
+        case OP_ORI: return "ORI";
+        case OP_XORI: return "XORI";
+        case OP_SHLI: return "SHLI";
+        case OP_SHRI: return "SHRI";
+        case OP_SARI: return "SARI";
+        case OP_INC: return "INC";
+        case OP_DEC: return "DEC";
+        case OP_CMPI: return "CMPI";
+        case OP_CALL: return "CALL";
+        case OP_RET: return "RET";
+        default: return "???";
+    }
+}
+
+// The operator an ALU instruction applies, as explain() writes it.
+static const char* aluSymbol(uint8_t op) {
+    switch (op) {
+        case OP_ADDR: case OP_ADDI: return "+";
+        case OP_SUBR: case OP_SUBI: return "-";
+        case OP_MULR: case OP_MULI: return "*";
+        case OP_DIVR: case OP_DIVI: return "/";
+        case OP_MODR: case OP_MODI: return "%";
+        case OP_ANDR: case OP_ANDI: return "&";
+        case OP_ORR:  case OP_ORI:  return "|";
+        case OP_XORR: case OP_XORI: return "^";
+        case OP_SHLR: case OP_SHLI: return "<<";
+        case OP_SHRR: case OP_SHRI: return ">>>";
+        case OP_SARR: case OP_SARI: return ">>";
+        default:                    return "?";
+    }
+}
+
+void Program::explain(std::ostream& os, const Instruction& ins) {
+    auto operand = [](int32_t r) { return r == 0xFF ? std::string("COUNTER") : "R" + std::to_string(r); };
+    auto range = [&](int32_t from) { return "MEM[" + std::to_string(from) + ".." + std::to_string(int64_t(from) + ins.c - 1) + "]"; };
+    switch (ins.opcode) {
+        case OP_MOV:    os << "  -> R" << ins.a << " = " << ins.b << "\n"; break;
+        case OP_ADDR:   os << "  -> R" << ins.a << " = R" << ins.b << " + R" << ins.c << "\n"; break;
+        case OP_SUBR:   os << "  -> R" << ins.a << " = R" << ins.b << " - R" << ins.c << "\n"; break;
+        case OP_MULR: case OP_DIVR: case OP_MODR: case OP_ANDR: case OP_ORR: case OP_XORR:
+        case OP_SHLR: case OP_SHRR: case OP_SARR:
+            os << "  -> R" << ins.a << " = R" << ins.b << " " << aluSymbol(ins.opcode) << " R" << ins.c << "\n"; break;
+        case OP_ADDI: case OP_SUBI: case OP_MULI: case OP_DIVI: case OP_MODI: case OP_ANDI: case OP_ORI:
+        case OP_XORI: case OP_SHLI: case OP_SHRI: case OP_SARI:
+            os << "  -> R" << ins.a << " = R" << ins.b << " " << aluSymbol(ins.opcode) << " " << ins.c << "\n"; break;
+        case OP_INC:    os << "  -> " << operand(ins.a) << " = " << operand(ins.a) << " + 1\n"; break;
+        case OP_DEC:    os << "  -> " << operand(ins.a) << " = " << operand(ins.a) << " - 1\n"; break;
+        case OP_CMPI:   os << "  -> set flags by comparing " << operand(ins.a) << " vs " << ins.b << "\n"; break;
+        case OP_CALL:   os << "  -> call line " << ins.a + 1 << ", returning to the next line\n"; break;
+        case OP_RET:    os << "  -> return to the line after the last CALL\n"; break;
+        case OP_LOADMR: os << "  -> R" << ins.a << " = MEM[" << ins.b << "]\n"; break;
+        case OP_STOREMR:os << "  -> MEM[" << ins.a << "] = R" << ins.b << "\n"; break;
+        case OP_CMP:    os << "  -> set flags by comparing " << operand(ins.a) << " vs " << operand(ins.b) << "\n"; break;
+        case OP_JEQ:    os << "  -> jump if EQ to line " << ins.a << "\n"; break;
+        case OP_JGT:    os << "  -> jump if GT to line " << ins.a << "\n"; break;
+        case OP_JLT:    os << "  -> jump if LT to line " << ins.a << "\n"; break;
+        case OP_HOP:    os << "  -> jump to line " << ins.a << "\n"; break;
+        case OP_HZ:     os << "  -> pop, jump if zero to line " << ins.a << "\n"; break;
+        case OP_HNZ:    os << "  -> pop, jump if not zero to line " << ins.a << "\n"; break;
+        case OP_CHNZ:   os << "  -> jump if COUNTER != 0 to line " << ins.a << "\n"; break;
+        case OP_LOAD:   os << "  -> COUNTER = " << ins.a << "\n"; break;
+        case OP_SETM:   os << "  -> MEM[" << ins.a << "] = " << ins.b << "\n"; break;
+        case OP_VADD:   os << "  -> " << range(ins.a) << " += " << range(ins.b) << "\n"; break;
+        case OP_VFILL:  os << "  -> " << range(ins.a) << " = R" << ins.b << "\n"; break;
+        case OP_VCOPY:  os << "  -> " << range(ins.a) << " = " << range(ins.b) << "\n"; break;
+        case OP_VSUM:   os << "  -> R" << ins.a << " = sum of " << range(ins.b) << "\n"; break;
+        case OP_VCNT:   os << "  -> R" << ins.a << " = cells of " << range(ins.b) << " equal to R" << ins.a << "\n"; break;
+        case OP_VMIN:   os << "  -> R" << ins.a << " = least of " << range(ins.b) << "\n"; break;
+        case OP_VMAX:   os << "  -> R" << ins.a << " = greatest of " << range(ins.b) << "\n"; break;
+        default: break;
+    }
+}
+
+
+// --- pre-decode ---
+// Every operand is checked here once, so the interpreter loop can index
+// registers and memory without bounds checks. Jump targets become op
+// indices (a jump to line N resumes at index N, matching the old
+// pc = N-1; ++pc), and CEASE or running off the end lands on a HALT op.
+// With `labels` (computed-goto builds) each op is threaded as it is made.
+
+bool Program::decode(std::string& error, const void* const* labels) {
+    const int n = (int)bytecode.size();
+    reserveLarge(ops, n + 1);
+    ops.assign(n + 1, Op{});
+
+    auto fail = [&](int i, const std::string& what) {
+        error = "line " + std::to_string(i + 1) + " (" + opcodeName(bytecode[i].opcode) + "): " + what;
+        return false;
+    };
+    auto reg = [&](int32_t r) { return r >= 0 && r < VM_REGISTERS; };
+    auto addr = [&](int32_t a) { return a >= 0 && uint64_t(a) < memoryCells; };
+    auto regOrCounter = [&](int32_t r) { return r == 0xFF || reg(r); };
+    // a block op's n cells from `from` are all in memory (n > 0)
+    auto range = [&](int32_t from, int32_t n) { return from >= 0 && uint64_t(from) + uint64_t(n) <= memoryCells; };
+    auto rangeError = [&](int32_t from, int32_t n) {
+        return "memory range " + std::to_string(from) + ".." + std::to_string(int64_t(from) + n - 1) + " out of range";
+    };
+
+    for (int i = 0; i < n; ++i) {
+        const Instruction& in = bytecode[i];
+        Op& op = ops[i];
+        op.a = in.a; op.b = in.b; op.c = in.c;
+
+        switch (in.opcode) {
+            case OP_PUSH:   op.code = X_PUSH; break;
+            case OP_PRINT:  op.code = X_PRINT; break;
+            case OP_DECR:   op.code = X_DECR; break;
+            case OP_CPRINT: op.code = X_CPRINT; break;
+            case OP_CEASE:  op.code = X_JMP; op.a = n; break;
+            case OP_ADD:    op.code = X_ADD; break;
+            case OP_SUB:    op.code = X_SUB; break;
+            case OP_MUL:    op.code = X_MUL; break;
+            case OP_DUP:    op.code = X_DUP; break;
+            case OP_LOAD:   op.code = X_LOADC; break;
+            case OP_RET:    op.code = X_RET; break;
+            case OP_MEMDUMP: op.code = X_MEMDUMP; break;
+
+            case OP_SETM:
+                if (!addr(in.a)) return fail(i, "memory address " + std::to_string(in.a) + " out of range");
+                op.code = X_SETM;
+                break;
+
+            case OP_MOV:
+            case OP_LOADR:
+            case OP_STORER:
+            case OP_PRINTR:
+                if (!reg(in.a)) return fail(i, "register R" + std::to_string(in.a) + " out of range (R0-R7)");
+                op.code = in.opcode == OP_MOV    ? X_MOV
+                        : in.opcode == OP_LOADR  ? X_LOADR
+                        : in.opcode == OP_STORER ? X_STORER : X_PRINTR;
+                break;
+
+            case OP_ADDR: case OP_SUBR: case OP_MULR: case OP_DIVR: case OP_MODR:
+            case OP_ANDR: case OP_ORR: case OP_XORR: case OP_SHLR: case OP_SHRR: case OP_SARR:
+                if (!reg(in.a) || !reg(in.b) || !reg(in.c))
+                    return fail(i, "register operand out of range (R0-R7)");
+                switch (in.opcode) {
+                    case OP_ADDR: op.code = X_ADDR; break;
+                    case OP_SUBR: op.code = X_SUBR; break;
+                    case OP_MULR: op.code = X_MULR; break;
+                    case OP_DIVR: op.code = X_DIVR; break;
+                    case OP_MODR: op.code = X_MODR; break;
+                    case OP_ANDR: op.code = X_ANDR; break;
+                    case OP_ORR:  op.code = X_ORR; break;
+                    case OP_XORR: op.code = X_XORR; break;
+                    case OP_SHLR: op.code = X_SHLR; break;
+                    case OP_SHRR: op.code = X_SHRR; break;
+                    default:      op.code = X_SARR; break;
+                }
+                break;
+
+            // immediates are taken as they are, except: SUBI becomes ADDI
+            // of the negated constant, shift counts are reduced mod 32, and
+            // dividing by a constant 0 is refused here rather than at run time
+            case OP_ADDI: case OP_SUBI: case OP_MULI: case OP_DIVI: case OP_MODI: case OP_ANDI:
+            case OP_ORI: case OP_XORI: case OP_SHLI: case OP_SHRI: case OP_SARI:
+                if (!reg(in.a) || !reg(in.b)) return fail(i, "register operand out of range (R0-R7)");
+                if ((in.opcode == OP_DIVI || in.opcode == OP_MODI) && in.c == 0) return fail(i, "division by zero");
+                switch (in.opcode) {
+                    case OP_ADDI: op.code = X_ADDI; break;
+                    case OP_SUBI: op.code = X_ADDI; op.c = int32_t(0u - uint32_t(in.c)); break;
+                    case OP_MULI: op.code = X_MULI; break;
+                    case OP_DIVI: op.code = X_DIVI; break;
+                    case OP_MODI: op.code = X_MODI; break;
+                    case OP_ANDI: op.code = X_ANDI; break;
+                    case OP_ORI:  op.code = X_ORI; break;
+                    case OP_XORI: op.code = X_XORI; break;
+                    case OP_SHLI: op.code = X_SHLI; op.c = in.c & 31; break;
+                    case OP_SHRI: op.code = X_SHRI; op.c = in.c & 31; break;
+                    default:      op.code = X_SARI; op.c = in.c & 31; break;
+                }
+                break;
+
+            case OP_INC:
+            case OP_DEC:
+                if (!regOrCounter(in.a)) return fail(i, "operand must be R0-R7 or COUNTER");
+                if (in.a == 0xFF) op.code = (in.opcode == OP_INC) ? X_INCC : X_DECR;
+                else op.code = (in.opcode == OP_INC) ? X_INC : X_DEC;
+                break;
+
+            case OP_CMPI:
+                if (!regOrCounter(in.a)) return fail(i, "operand must be R0-R7 or COUNTER");
+                op.code = (in.a == 0xFF) ? X_CMP_CI : X_CMP_RI;
+                break;
+
+            // block ops: the length in c, then the ranges and registers;
+            // VADD's two ranges must be the same or not overlap at all, so
+            // every kernel width gives the same answer
+            case OP_VADD:
+            case OP_VCOPY:
+            case OP_VFILL:
+            case OP_VSUM:
+            case OP_VCNT:
+            case OP_VMIN:
+            case OP_VMAX:
+                if (in.c < 1) return fail(i, "block length " + std::to_string(in.c) + " must be at least 1");
+                if (in.opcode == OP_VADD || in.opcode == OP_VCOPY || in.opcode == OP_VFILL) {
+                    if (!range(in.a, in.c)) return fail(i, rangeError(in.a, in.c));
+                } else if (!reg(in.a)) {
+                    return fail(i, "register R" + std::to_string(in.a) + " out of range (R0-R7)");
+                }
+                if (in.opcode == OP_VFILL) {
+                    if (!reg(in.b)) return fail(i, "register R" + std::to_string(in.b) + " out of range (R0-R7)");
+                } else if (!range(in.b, in.c)) {
+                    return fail(i, rangeError(in.b, in.c));
+                }
+                if (in.opcode == OP_VADD && in.a != in.b && int64_t(in.a) < int64_t(in.b) + in.c
+                    && int64_t(in.b) < int64_t(in.a) + in.c)
+                    return fail(i, "source and destination ranges overlap");
+                switch (in.opcode) {
+                    case OP_VADD:  op.code = X_VADD; break;
+                    case OP_VCOPY: op.code = X_VCOPY; break;
+                    case OP_VFILL: op.code = X_VFILL; break;
+                    case OP_VSUM:  op.code = X_VSUM; break;
+                    case OP_VCNT:  op.code = X_VCNT; break;
+                    case OP_VMIN:  op.code = X_VMIN; break;
+                    default:       op.code = X_VMAX; break;
+                }
+                break;
+
+            case OP_CMP:
+                if (!regOrCounter(in.a) || !regOrCounter(in.b))
+                    return fail(i, "operand must be R0-R7 or COUNTER");
+                if (in.a == 0xFF) op.code = (in.b == 0xFF) ? X_CMP_CC : X_CMP_CR;
+                else              op.code = (in.b == 0xFF) ? X_CMP_RC : X_CMP_RR;
+                break;
+
+            case OP_JEQ:
+            case OP_JNE:
+            case OP_JGT:
+            case OP_JLT:
+            case OP_HOP:
+            case OP_HZ:
+            case OP_HNZ:
+            case OP_CHNZ:
+            case OP_CALL:
+                if (in.a < 0) return fail(i, "jump target " + std::to_string(in.a) + " is negative");
+                switch (in.opcode) {
+                    case OP_JEQ: op.code = X_JEQ; break;
+                    case OP_JNE: op.code = X_JNE; break;
+                    case OP_JGT: op.code = X_JGT; break;
+                    case OP_JLT: op.code = X_JLT; break;
+                    case OP_HOP: op.code = X_JMP; break;
+                    case OP_HZ:  op.code = X_JZ; break;
+                    case OP_HNZ: op.code = X_JNZ; break;
+                    case OP_CALL: op.code = X_CALL; break;
+                    default:     op.code = X_CJNZ; break;
+                }
+                op.a = std::min(in.a, n);  // past the end: halt
+                break;
+
+            case OP_LOADM:
+            case OP_STOREM:
+                if (!addr(in.a)) return fail(i, "memory address " + std::to_string(in.a) + " out of range");
+                op.code = (in.opcode == OP_LOADM) ? X_LOADM : X_STOREM;
+                break;
+
+            case OP_LOADMR:
+                if (!reg(in.a)) return fail(i, "register R" + std::to_string(in.a) + " out of range (R0-R7)");
+                if (!addr(in.b)) return fail(i, "memory address " + std::to_string(in.b) + " out of range");
+                op.code = X_LOADMR;
+                break;
+
+            case OP_STOREMR:
+                if (!addr(in.a)) return fail(i, "memory address " + std::to_string(in.a) + " out of range");
+                if (!reg(in.b)) return fail(i, "register R" + std::to_string(in.b) + " out of range (R0-R7)");
+                op.code = X_STOREMR;
+                break;
+
+            default: {
+                std::ostringstream os;
+                os << "unsupported opcode 0x" << std::hex << int(in.opcode);
+                return fail(i, os.str());
+            }
+        }
+    }
+    ops[n].code = X_HALT;
+    if (labels)
+        for (Op& op : ops) op.handler = labels[op.code];
+    return true;
+}
+
+
+// --- superinstruction fusion ---
+// Peephole pass over the decoded ops. Fusion is done in place: slot i gets
+// the fused op for the sequence starting at i and the following slots keep
+// their plain ops, so a jump into the middle of a sequence still lands on
+// the right instruction and no jump target has to be rewritten. Only the
+// fast run loop uses `fused`; the stepper keeps executing `ops`, and the
+// `fusions` side table records which original lines each fused op covers.
+
+void Program::fuse(const void* const* labels) {
+    reserveLarge(fused, ops.size());
+    fused = ops;
+    fusions.clear();
+    const int n = (int)ops.size() - 1;  // last op is HALT
+
+    auto condOf = [](uint8_t code) {
+        switch (code) {
+            case X_JEQ: return 0;
+            case X_JNE: return 1;
+            case X_JGT: return 2;
+            case X_JLT: return 3;
+            default:    return -1;
+        }
+    };
+
+    for (int i = 0; i < n; ++i) {
+        const Op& op = ops[i];
+        Op& out = fused[i];
+        int length = 0;
+
+        if (op.code == X_DECR && i + 2 < n && (ops[i+1].code == X_CMP_CR || ops[i+1].code == X_CMP_CI)
+            && condOf(ops[i+2].code) >= 0) {
+            int base = (ops[i+1].code == X_CMP_CR) ? X_DCMPJ_EQ : X_DCMPJI_EQ;
+            out.code = uint8_t(base + condOf(ops[i+2].code));
+            out.b = ops[i+1].b;
+            out.c = ops[i+2].a;
+            length = 3;
+        } else if ((op.code == X_CMP_RR || op.code == X_CMP_CR || op.code == X_CMP_RI || op.code == X_CMP_CI)
+                   && i + 1 < n && condOf(ops[i+1].code) >= 0) {
+            int base = op.code == X_CMP_RR ? X_CMPJ_RR_EQ : op.code == X_CMP_CR ? X_CMPJ_CR_EQ
+                     : op.code == X_CMP_RI ? X_CMPJ_RI_EQ : X_CMPJ_CI_EQ;
+            out.code = uint8_t(base + condOf(ops[i+1].code));
+            out.c = ops[i+1].a;
+            length = 2;
+        } else if (op.code == X_MOV && i + 1 < n && ops[i+1].code == X_MOV) {
+            out.code = X_MOV2;
+            out.c = ops[i+1].a;
+            out.d = ops[i+1].b;
+            length = 2;
+        }
+
+        if (length) {
+            if (labels) out.handler = labels[out.code];
+            fusions.push_back({i, length});
+        }
+    }
+}
+
+
+// --- basic blocks ---
+// Leaders are op 0, every jump or CALL target and every op after a jump,
+// CALL or RET. They are flagged OPF_LEADER in both streams so the tiered
+// runner can stop the interpreter at block boundaries and count entries.
+
+void Program::findBlocks() {
+    const int n = (int)ops.size() - 1;  // last op is HALT
+    std::vector<bool> leader(n + 1, false);
+    leader[0] = true;
+    for (int i = 0; i < n; ++i) {
+        switch (ops[i].code) {
+            case X_JEQ: case X_JNE: case X_JGT: case X_JLT: case X_JMP:
+            case X_JZ: case X_JNZ: case X_CJNZ: case X_CALL:
+                leader[ops[i].a] = true;
+                leader[i + 1] = true;
+                break;
+            case X_RET:
+                leader[i + 1] = true;
+                break;
+        }
+    }
+
+    blockOf.assign(n + 1, 0);
+    for (int i = 0; i < n; ++i) {
+        if (leader[i]) {
+            if (!blocks.empty()) blocks.back().end = i;
+            blocks.push_back({i, n});
+            ops[i].flags |= OPF_LEADER;
+            fused[i].flags |= OPF_LEADER;
+        }
+        blockOf[i] = (int)blocks.size() - 1;
+    }
+}
+
+
+// --- stack depth proof ---
+// Each block's stack ops pop and push a fixed number of values, so its
+// effect relative to the depth it is entered with is known: how far below
+// that depth it reaches (`need`) and how far above (`grow`). Depths are
+// then pushed along the control flow from 0 at op 0. A block every path
+// enters at the same depth d, with d >= need, provably neither underflows
+// nor goes past d + grow; its stack ops in `fused` become the _U forms,
+// which test nothing. Blocks entered at differing depths (a loop that
+// pushes), or that would underflow (and so rely on the no-op a pop from
+// an empty stack is), keep their tested forms, and so does everything
+// after them. The depth a CALL returns at depends on the subroutine, so
+// the line after a CALL is taken to be entered at differing depths.
+// maxStack is the deepest any proven block goes; a machine whose stack is
+// smaller refuses the program (see VirtualMachine::stackFits).
+
+void Program::proveStack(const void* const* labels) {
+    struct Effect { int pops, pushes; };
+    auto effect = [](uint8_t code) -> Effect {
+        switch (code) {
+            case X_PUSH: case X_LOADR: case X_LOADM: return {0, 1};
+            case X_STORER: case X_STOREM: case X_JZ: case X_JNZ: return {1, 0};
+            case X_PRINT: return {1, 1};
+            case X_DUP: return {1, 2};
+            case X_ADD: case X_SUB: case X_MUL: return {2, 1};
+            default: return {0, 0};
+        }
+    };
+    auto unchecked = [](uint8_t code) -> int {
+        switch (code) {
+            case X_PUSH:   return X_PUSH_U;
+            case X_LOADR:  return X_LOADR_U;
+            case X_STORER: return X_STORER_U;
+            case X_PRINT:  return X_PRINT_U;
+            case X_LOADM:  return X_LOADM_U;
+            case X_STOREM: return X_STOREM_U;
+            case X_ADD:    return X_ADD_U;
+            case X_SUB:    return X_SUB_U;
+            case X_MUL:    return X_MUL_U;
+            case X_DUP:    return X_DUP_U;
+            case X_JZ:     return X_JZ_U;
+            case X_JNZ:    return X_JNZ_U;
+            default:       return -1;
+        }
+    };
+
+    const int n = (int)ops.size() - 1;  // last op is HALT
+    const int nb = (int)blocks.size();
+    std::vector<int> need(nb, 0), grow(nb, 0), net(nb, 0);
+    for (int b = 0; b < nb; ++b) {
+        int at = 0;
+        for (int i = blocks[b].start; i < blocks[b].end; ++i) {
+            Effect e = effect(ops[i].code);
+            need[b] = std::max(need[b], e.pops - at);
+            at += e.pushes - e.pops;
+            grow[b] = std::max(grow[b], at);
+        }
+        net[b] = at;
+    }
+
+    constexpr int UNSEEN = -2, VARIES = -1;
+    std::vector<int> entry(nb, UNSEEN);
+    std::vector<int> work;
+    auto reach = [&](int target, int depth) {
+        if (target >= n) return;  // HALT
+        int& e = entry[blockOf[target]];
+        int merged = (e == UNSEEN || e == depth) ? depth : VARIES;
+        if (merged != e) {
+            e = merged;
+            work.push_back(blockOf[target]);
+        }
+    };
+    if (n > 0) reach(0, 0);
+    while (!work.empty()) {
+        const int b = work.back();
+        work.pop_back();
+        const int d = entry[b];
+        const int out = (d >= need[b]) ? d + net[b] : VARIES;
+        const Op& last = ops[blocks[b].end - 1];
+        switch (last.code) {
+            case X_JMP:
+                reach(last.a, out);
+                break;
+            case X_CALL:
+                reach(last.a, out);
+                reach(blocks[b].end, VARIES);
+                break;
+            case X_RET:
+                break;  // to the lines after the CALLs, reached from those
+            case X_JEQ: case X_JNE: case X_JGT: case X_JLT: case X_JZ: case X_JNZ: case X_CJNZ:
+                reach(last.a, out);
+                reach(blocks[b].end, out);
+                break;
+            default:
+                reach(blocks[b].end, out);
+                break;
+        }
+    }
+
+    maxStack = 0;
+    for (int b = 0; b < nb; ++b) {
+        if (entry[b] < need[b]) continue;  // unreached, varying or underflowing
+        blocks[b].depth = entry[b];
+        blocks[b].peak = entry[b] + grow[b];
+        maxStack = std::max(maxStack, size_t(entry[b] + grow[b]));
+        for (int i = blocks[b].start; i < blocks[b].end; ++i) {
+            int u = unchecked(fused[i].code);
+            if (u < 0) continue;
+            fused[i].code = uint8_t(u);
+            if (labels) fused[i].handler = labels[u];
+        }
+    }
+}
+
+
+// --- call inlining ---
+// One pass over the records builds the copy, noting where each line went;
+// a second moves every jump and CALL target, all of them original lines
+// since the inlined bodies have none. The original program was validated
+// when it loaded, so the copy only needs decoding again.
+
+std::shared_ptr<const Program> Program::inlineCalls(const std::shared_ptr<const Program>& p, int maxOps) {
+    const int n = p->size();
+    const Bytecode& in = p->bytecode;
+    auto isJump = [](uint8_t opcode) {
+        switch (opcode) {
+            case OP_JEQ: case OP_JNE: case OP_JGT: case OP_JLT:
+            case OP_HOP: case OP_HZ: case OP_HNZ: case OP_CHNZ: case OP_CALL:
+                return true;
+            default:
+                return false;
+        }
+    };
+
+    // ops before the RET of the leaf subroutine at t, or -1 if it isn't one
+    std::vector<int> leafOps(n, -2);  // -2: not looked at yet
+    auto leaf = [&](int t) {
+        if (t >= n) return -1;
+        if (leafOps[t] == -2) {
+            leafOps[t] = -1;
+            for (int i = t; i < n && i - t <= maxOps; ++i) {
+                const uint8_t op = in[i].opcode;
+                if (op == OP_RET) { leafOps[t] = i - t; break; }
+                if (isJump(op) || op == OP_CEASE) break;
+            }
+        }
+        return leafOps[t];
+    };
+
+    std::vector<Instruction> out;
+    std::vector<int> at(n + 1);  // line -> its line in the copy
+    out.reserve(n);
+    int expanded = 0;
+    for (int i = 0; i < n; ++i) {
+        at[i] = (int)out.size();
+        const int body = in[i].opcode == OP_CALL ? leaf(in[i].a) : -1;
+        if (body < 0) {
+            out.push_back(in[i]);
+        } else {
+            out.insert(out.end(), in.data() + in[i].a, in.data() + in[i].a + body);
+            ++expanded;
+        }
+    }
+    at[n] = (int)out.size();
+    if (!expanded) return p;
+    for (Instruction& ins : out)
+        if (isJump(ins.opcode)) ins.a = at[std::min(ins.a, n)];
+
+    std::shared_ptr<Program> q(new Program());
+    q->owned = std::move(out);
+    q->bytecode.ptr = q->owned.data();
+    q->bytecode.n = q->owned.size();
+    q->data = p->data;
+    q->memoryCells = p->memoryCells;
+    q->version = p->version;
+    q->text = p->text;
+    q->fileBytes = p->fileBytes;
+    for (const Symbol& sym : p->symbols) {
+        // parse() keeps lines in [0, n]; anything else goes with the end
+        const int line = sym.line < 0 || sym.line > n ? n : sym.line;
+        q->symbols.push_back({sym.name, at[line]});
+    }
+    std::string why;
+    if (!q->build(why)) {
+        std::cerr << "inlining produced an invalid program: " << why << "\n";
+        return p;
+    }
+    return q;
+}
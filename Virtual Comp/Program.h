@@ -0,0 +1,128 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <iosfwd>
+#include <memory>
+#include <string>
+#include <vector>
+#include "Format.h"
+#include "Ops.h"
+
+// Machine limits the decoder validates operands against.
+constexpr int VM_REGISTERS = 8;       // R0-R7
+constexpr int VM_MEMORY_CELLS = 256;  // default memory size, unless the container asks for more
+
+// A loaded, validated and decoded bytecode program. It never changes after
+// load() returns, so one Program can be shared through std::shared_ptr by
+// any number of VirtualMachines, on any threads; each machine holds only
+// its own registers, counter, flags, stack and memory.
+class Program {
+public:
+    // one bytecode record, as stored in the container's code section;
+    // legacy 4-byte records are widened to this on load
+    using Instruction = CodeRecord;
+
+    // a name the assembler gave to a line (a label)
+    struct Symbol {
+        std::string name;
+        int line;
+    };
+
+    // A superinstruction in `fused`: the op at `pc` stands for `length`
+    // consecutive source lines starting there.
+    struct Fusion {
+        int pc;
+        int length;
+    };
+
+    // Read-only view of the records: the code section of the mapped file
+    // itself, or the program's own copy when the file could not be mapped
+    // or is in the legacy format.
+    class Bytecode {
+    public:
+        const Instruction& operator[](size_t i) const { return ptr[i]; }
+        const Instruction* data() const { return ptr; }
+        size_t size() const { return n; }
+        bool empty() const { return n == 0; }
+
+    private:
+        friend class Program;
+        const Instruction* ptr = nullptr;
+        size_t n = 0;
+    };
+
+    // A basic block: ops [start, end). Blocks begin at op 0, at every jump
+    // or CALL target and after every jump, CALL or RET.
+    struct Block {
+        int start, end;
+        int depth = -1;  // operand stack depth on entry, if proven (see proveStack)
+        int peak = -1;   // deepest it takes the stack, if proven
+    };
+
+    // Reads, validates and decodes a bytecode file (a container, see
+    // Format.h, or legacy records); "-" reads stdin. Regular files are
+    // memory-mapped, everything else is read in bulk.
+    // Returns null if the program is unreadable or invalid; the reason goes
+    // to *error, or to std::cerr when error is null.
+    static std::shared_ptr<const Program> load(const std::string& filename, std::string* error = nullptr);
+    static std::shared_ptr<const Program> fromStream(std::istream& in, const std::string& name,
+                                                     std::string* error = nullptr);
+    static std::shared_ptr<const Program> fromMemory(const void* data, size_t size,
+                                                     const std::string& name = "<memory>",
+                                                     std::string* error = nullptr);
+
+    // Optional load-time pass (--inline): a copy of `p` in which every CALL
+    // of a small leaf subroutine (at most maxOps ops with no jump or CALL
+    // among them, then RET) is replaced by the subroutine's ops. Jump
+    // targets and labels are moved to match, so lines in the copy no longer
+    // match the source. Returns `p` itself when no CALL qualifies.
+    static constexpr int INLINE_MAX_OPS = 8;
+    static std::shared_ptr<const Program> inlineCalls(const std::shared_ptr<const Program>& p,
+                                                      int maxOps = INLINE_MAX_OPS);
+
+    ~Program();
+    Program(const Program&) = delete;
+    Program& operator=(const Program&) = delete;
+
+    static const char* opcodeName(uint8_t op);  // mnemonic
+    // what an instruction does, as `  -> R1 = R1 + R2` lines (--explain);
+    // nothing for instructions without a hint
+    static void explain(std::ostream& os, const Instruction& ins);
+
+    Bytecode bytecode;
+    std::vector<Op> ops;              // 1:1 with bytecode (stepper); back() is HALT
+    std::vector<Op> fused;            // ops with superinstructions (run loop)
+    std::vector<Fusion> fusions;      // side table back to source lines
+    std::vector<Block> blocks;        // in program order
+    std::vector<int> blockOf;         // op index -> block holding it
+    std::vector<int32_t> data;        // initial memory, from cell 0
+    uint64_t memoryCells = VM_MEMORY_CELLS;  // every address used is below this
+    size_t maxStack = 0;              // deepest the stack gets in proven blocks
+    std::vector<Symbol> symbols;      // in the order the file lists them
+    int version = 0;                  // container version; 0 for legacy files
+    bool text = false;                // compiled from text mode (VMBC_FLAG_TEXT)
+
+    int size() const { return (int)bytecode.size(); }
+    bool mapped() const { return mapping != nullptr; }  // records used straight from the file
+    size_t fileSize() const { return fileBytes; }
+
+private:
+    Program() = default;
+    static std::shared_ptr<const Program> finish(std::shared_ptr<Program> p, const std::string& name,
+                                                 std::string* error);
+
+    void* mapping = nullptr;            // mmap'd file backing `bytecode`
+    size_t mappingSize = 0;
+    std::vector<Instruction> owned;     // otherwise the records live here
+    std::vector<uint32_t> image;        // or the file read into memory
+    size_t imageSize = 0;               // bytes of `image` in use
+    size_t fileBytes = 0;
+
+    bool parse(const void* bytes, size_t size, std::string& error);
+    void release();
+    bool build(std::string& error);  // decode() then the passes after it
+    bool decode(std::string& error, const void* const* labels);
+    void fuse(const void* const* labels);
+    void findBlocks();
+    void proveStack(const void* const* labels);
+};
@@ -0,0 +1,55 @@
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <vector>
+
+constexpr size_t VM_STACK_DEPTH = 1024;  // default operand stack capacity
+constexpr size_t VM_CALL_DEPTH = 256;    // return stack capacity (CALL nesting)
+
+// The operand stack: a fixed number of int slots, allocated once, so a
+// push never allocates. Slot 0 is never a value; values live in slots
+// 1..size(). The interpreter keeps the top in a local while it runs (see
+// VirtualMachine::interpretCore), and the spare slot lets it spill that
+// local on a push, or reload it on a pop, without testing for an empty
+// stack: an empty stack's "top" is slot 0.
+class OperandStack {
+public:
+    explicit OperandStack(size_t capacity = VM_STACK_DEPTH) : slots(capacity + 1, 0) {}
+
+    size_t size() const { return depth; }
+    bool empty() const { return depth == 0; }
+    size_t capacity() const { return slots.size() - 1; }
+    bool full() const { return depth == capacity(); }
+
+    // Changes the capacity, never below the values held.
+    void setCapacity(size_t n) { slots.resize(std::max(n, depth) + 1, 0); }
+
+    int operator[](size_t i) const { return slots[i + 1]; }  // from the bottom
+    int top() const { return slots[depth]; }
+    int& top() { return slots[depth]; }
+    // callers check full() / empty() first
+    void push(int v) { slots[++depth] = v; }
+    int pop() { return slots[depth--]; }
+    void clear() { depth = 0; }
+
+    // the values, bottom first (snapshots), and back
+    std::vector<int> values() const { return std::vector<int>(slots.begin() + 1, slots.begin() + 1 + depth); }
+    void assign(const std::vector<int>& v) {
+        if (v.size() > capacity()) setCapacity(v.size());
+        std::copy(v.begin(), v.end(), slots.begin() + 1);
+        depth = v.size();
+    }
+    bool operator==(const OperandStack& o) const {
+        return depth == o.depth && std::equal(slots.begin() + 1, slots.begin() + 1 + depth, o.slots.begin() + 1);
+    }
+    bool operator!=(const OperandStack& o) const { return !(*this == o); }
+
+    // interpreter access: slot 0, and the value count after a run that
+    // kept its own pointer
+    int* base() { return slots.data(); }
+    void setSize(size_t n) { depth = n; }
+
+private:
+    std::vector<int> slots;
+    size_t depth = 0;
+};
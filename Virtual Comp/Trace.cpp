@@ -0,0 +1,137 @@
+#include "Trace.h"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <ostream>
+#include "Program.h"
+
+TraceWriter::TraceWriter(size_t capacity) {
+    size_t n = 1024;
+    while (n < capacity) n <<= 1;
+    ring.resize(n);
+    mask = n - 1;
+}
+
+TraceWriter::~TraceWriter() { close(); }
+
+bool TraceWriter::open(const std::string& path, int lines, std::string& error) {
+    close();
+    file = std::fopen(path.c_str(), "wb");
+    if (!file) {
+        error = "cannot create " + path;
+        return false;
+    }
+    TraceHeader h{};
+    std::memcpy(h.magic, "VMTR", 4);
+    h.version = TRACE_VERSION;
+    h.recordSize = sizeof(TraceRecord);
+    h.lines = uint32_t(lines);
+    failed = std::fwrite(&h, sizeof(h), 1, file) != 1;
+
+    head = tailSeen = 0;
+    published.store(0, std::memory_order_relaxed);
+    consumed.store(0, std::memory_order_relaxed);
+    stopping.store(false, std::memory_order_relaxed);
+    writer = std::thread(&TraceWriter::drain, this);
+    return true;
+}
+
+bool TraceWriter::close() {
+    if (!file) return true;
+    stopping.store(true, std::memory_order_release);
+    writer.join();
+    bool ok = !failed && std::fclose(file) == 0;
+    file = nullptr;
+    return ok;
+}
+
+// The ring is full: wait for the writer thread to catch up.
+void TraceWriter::waitForRoom() {
+    for (;;) {
+        tailSeen = consumed.load(std::memory_order_acquire);
+        if (head - tailSeen <= mask) return;
+        std::this_thread::yield();
+    }
+}
+
+// Writes everything published so far, in at most two pieces (the ring may
+// wrap), then hands the slots back. A write error is remembered and later
+// records are still consumed, so the interpreter never waits forever.
+void TraceWriter::drain() {
+    uint64_t tail = 0;
+    for (;;) {
+        const bool last = stopping.load(std::memory_order_acquire);
+        const uint64_t end = published.load(std::memory_order_acquire);
+        if (end == tail) {
+            if (last) return;
+            std::this_thread::sleep_for(std::chrono::microseconds(200));
+            continue;
+        }
+        while (tail < end) {
+            size_t from = size_t(tail & mask);
+            size_t n = size_t(std::min<uint64_t>(end - tail, ring.size() - from));
+            if (!failed) failed = std::fwrite(&ring[from], sizeof(TraceRecord), n, file) != n;
+            tail += n;
+        }
+        consumed.store(tail, std::memory_order_release);
+    }
+}
+
+TraceReader::~TraceReader() {
+    if (file) std::fclose(file);
+}
+
+bool TraceReader::open(const std::string& path, std::string& error) {
+    file = std::fopen(path.c_str(), "rb");
+    if (!file) {
+        error = "cannot open " + path;
+        return false;
+    }
+    if (std::fread(&head, sizeof(head), 1, file) != 1 || std::memcmp(head.magic, "VMTR", 4) != 0) {
+        error = path + " is not a trace file";
+        return false;
+    }
+    if (head.version != TRACE_VERSION || head.recordSize != sizeof(TraceRecord)) {
+        error = path + ": unsupported trace version " + std::to_string(head.version);
+        return false;
+    }
+    block.resize(4096);
+    return true;
+}
+
+bool TraceReader::next(TraceRecord& r) {
+    if (at == held) {
+        held = std::fread(block.data(), sizeof(TraceRecord), block.size(), file);
+        at = 0;
+        if (!held) return false;
+    }
+    r = block[at++];
+    return true;
+}
+
+void printTraceRecord(std::ostream& os, uint64_t n, const TraceRecord& r, bool explain) {
+    Program::Instruction ins{};
+    ins.opcode = r.opcode;
+    ins.a = r.a; ins.b = r.b; ins.c = r.c;
+    os << "#" << n << " PC " << r.pc + 1 << ": " << Program::opcodeName(r.opcode)
+       << " " << r.a << " " << r.b << " " << r.c << "\n";
+    if (explain) Program::explain(os, ins);
+
+    switch (r.change) {
+        case TRACE_REG:     os << "  => R" << r.index << " = " << r.value << "\n"; break;
+        case TRACE_COUNTER: os << "  => COUNTER = " << r.value << "\n"; break;
+        case TRACE_MEM:     os << "  => MEM[" << r.index << "] = " << r.value << "\n"; break;
+        case TRACE_PUSH:    os << "  => push " << r.value << " (depth " << r.depth << ")\n"; break;
+        case TRACE_POP_REG: os << "  => R" << r.index << " = " << r.value << " (popped, depth " << r.depth << ")\n"; break;
+        case TRACE_POP_MEM: os << "  => MEM[" << r.index << "] = " << r.value << " (popped, depth " << r.depth << ")\n"; break;
+        case TRACE_BLOCK:   os << "  => MEM[" << r.index << ".." << int64_t(r.index) + r.value - 1 << "] written\n"; break;
+        case TRACE_FLAGS:
+            os << "  => EQ: " << (r.flags & 1) << ", GT: " << (r.flags >> 1 & 1) << ", LT: " << (r.flags >> 2 & 1) << "\n";
+            break;
+        case TRACE_JUMP:
+            if (r.index) os << "  => jumped to line " << r.value + 1 << "\n";
+            else os << "  => not taken\n";
+            break;
+        default: break;
+    }
+}
@@ -0,0 +1,111 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <iosfwd>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Binary execution trace (--trace-file): a 16-byte header, then one 32-byte
+// TraceRecord per instruction run, in execution order, to the end of the
+// file. Records carry the bytecode record itself, so a trace can be decoded
+// without the program that made it (--trace-dump).
+struct TraceHeader {
+    char magic[4];        // "VMTR"
+    uint16_t version;     // TRACE_VERSION
+    uint16_t recordSize;  // sizeof(TraceRecord)
+    uint32_t lines;       // lines in the traced program
+    uint32_t reserved;
+};
+static_assert(sizeof(TraceHeader) == 16, "trace header layout");
+
+constexpr uint16_t TRACE_VERSION = 1;
+
+// What an instruction changed (TraceRecord::change).
+enum TraceChange : uint8_t {
+    TRACE_NONE,      // nothing but pc (output, or a pop from an empty stack)
+    TRACE_REG,       // register `index` is now `value`
+    TRACE_COUNTER,   // COUNTER is now `value`
+    TRACE_MEM,       // memory[index] is now `value`
+    TRACE_PUSH,      // pushed `value`
+    TRACE_POP_REG,   // popped `value` into register `index`
+    TRACE_POP_MEM,   // popped `value` into memory[index]
+    TRACE_FLAGS,     // compare: see `flags`
+    TRACE_JUMP,      // jump: next line index `value`, `index` 1 if taken
+    TRACE_BLOCK,     // a block op wrote `value` cells from memory[index]
+};
+
+struct TraceRecord {
+    int32_t pc;        // line index
+    uint8_t opcode;    // bytecode opcode
+    uint8_t change;    // TraceChange
+    uint8_t flags;     // EQ | GT << 1 | LT << 2, after
+    uint8_t pad;
+    int32_t a, b, c;   // operands as in the bytecode
+    int32_t index;
+    int32_t value;
+    uint32_t depth;    // stack depth, after
+};
+static_assert(sizeof(TraceRecord) == 32, "trace record layout");
+
+// Streams TraceRecords to a file. The interpreter fills slots of a
+// single-producer, single-consumer ring and a background thread writes
+// them out in large blocks; neither side takes a lock. When the disk falls
+// behind the interpreter waits for room, so no record is ever dropped.
+class TraceWriter {
+public:
+    explicit TraceWriter(size_t capacity = size_t(1) << 16);  // records; rounded up to a power of two
+    ~TraceWriter();
+    TraceWriter(const TraceWriter&) = delete;
+    TraceWriter& operator=(const TraceWriter&) = delete;
+
+    // false (with the reason in `error`) if the file can't be created
+    bool open(const std::string& path, int lines, std::string& error);
+    // writes what is left and stops the thread; false if any write failed
+    bool close();
+
+    // the slot for the next record, filled in place until publish()
+    TraceRecord& claim() {
+        if (head - tailSeen > mask) waitForRoom();
+        return ring[head & mask];
+    }
+    void publish() { published.store(++head, std::memory_order_release); }
+
+    uint64_t records() const { return head; }
+
+private:
+    void waitForRoom();
+    void drain();  // writer thread
+
+    std::vector<TraceRecord> ring;
+    size_t mask;
+    uint64_t head = 0;      // interpreter: records claimed and published
+    uint64_t tailSeen = 0;  // interpreter: last `consumed` it read
+    alignas(64) std::atomic<uint64_t> published{0};
+    alignas(64) std::atomic<uint64_t> consumed{0};
+    std::atomic<bool> stopping{false};
+    bool failed = false;    // writer thread only, until joined
+    std::FILE* file = nullptr;
+    std::thread writer;
+};
+
+// Reads a trace back, record by record.
+class TraceReader {
+public:
+    ~TraceReader();
+    bool open(const std::string& path, std::string& error);
+    bool next(TraceRecord& r);
+    const TraceHeader& header() const { return head; }
+
+private:
+    std::FILE* file = nullptr;
+    TraceHeader head{};
+    std::vector<TraceRecord> block;
+    size_t at = 0, held = 0;
+};
+
+// One record as text: `#n PC line: NAME a b c`, the explain hint if asked,
+// then what it changed.
+void printTraceRecord(std::ostream& os, uint64_t n, const TraceRecord& r, bool explain);
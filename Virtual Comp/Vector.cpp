@@ -0,0 +1,314 @@
+#include "Vector.h"
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <vector>
+
+// x86 builds get the SSE2 set when the compiler targets SSE2 (always on
+// x86-64) and the AVX2 set through per-function target attributes, so the
+// binary needs no -mavx2 and still runs on CPUs without it.
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define VM_VECTOR_X86 1
+#else
+#define VM_VECTOR_X86 0
+#endif
+
+namespace {
+
+// --- scalar ---
+// Unsigned arithmetic, so a sum or add that overflows wraps as the vector
+// units do instead of being undefined.
+
+void addScalar(int32_t* d, const int32_t* s, size_t n) {
+    for (size_t i = 0; i < n; ++i) d[i] = int32_t(uint32_t(d[i]) + uint32_t(s[i]));
+}
+void fillScalar(int32_t* d, size_t n, int32_t v) { std::fill(d, d + n, v); }
+int32_t sumScalar(const int32_t* s, size_t n) {
+    uint32_t t = 0;
+    for (size_t i = 0; i < n; ++i) t += uint32_t(s[i]);
+    return int32_t(t);
+}
+int32_t countScalar(const int32_t* s, size_t n, int32_t v) { return int32_t(std::count(s, s + n, v)); }
+int32_t minScalar(const int32_t* s, size_t n) { return *std::min_element(s, s + n); }
+int32_t maxScalar(const int32_t* s, size_t n) { return *std::max_element(s, s + n); }
+
+const VectorKernels SCALAR = {"scalar", addScalar, fillScalar, sumScalar, countScalar, minScalar, maxScalar};
+
+#if VM_VECTOR_X86 && defined(__SSE2__)
+// --- SSE2: 4 cells a step, the tail in scalar code ---
+
+void addSse2(int32_t* d, const int32_t* s, size_t n) {
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(d + i));
+        __m128i y = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(d + i), _mm_add_epi32(x, y));
+    }
+    addScalar(d + i, s + i, n - i);
+}
+void fillSse2(int32_t* d, size_t n, int32_t v) {
+    const __m128i x = _mm_set1_epi32(v);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) _mm_storeu_si128(reinterpret_cast<__m128i*>(d + i), x);
+    fillScalar(d + i, n - i, v);
+}
+// lanes of a vector, added up
+int32_t lanesSse2(__m128i x) {
+    alignas(16) int32_t l[4];
+    _mm_store_si128(reinterpret_cast<__m128i*>(l), x);
+    return int32_t(uint32_t(l[0]) + uint32_t(l[1]) + uint32_t(l[2]) + uint32_t(l[3]));
+}
+int32_t sumSse2(const int32_t* s, size_t n) {
+    __m128i t = _mm_setzero_si128();
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) t = _mm_add_epi32(t, _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + i)));
+    return int32_t(uint32_t(lanesSse2(t)) + uint32_t(sumScalar(s + i, n - i)));
+}
+int32_t countSse2(const int32_t* s, size_t n, int32_t v) {
+    // a match compares to -1, so subtracting it counts one
+    const __m128i key = _mm_set1_epi32(v);
+    __m128i t = _mm_setzero_si128();
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4)
+        t = _mm_sub_epi32(t, _mm_cmpeq_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(s + i)), key));
+    return lanesSse2(t) + countScalar(s + i, n - i, v);
+}
+// SSE2 has no 32-bit min/max; select through a compare mask
+template <bool Max>
+int32_t extremeSse2(const int32_t* s, size_t n) {
+    if (n < 4) return Max ? maxScalar(s, n) : minScalar(s, n);
+    __m128i m = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s));
+    size_t i = 4;
+    for (; i + 4 <= n; i += 4) {
+        __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + i));
+        __m128i take = Max ? _mm_cmpgt_epi32(x, m) : _mm_cmplt_epi32(x, m);
+        m = _mm_or_si128(_mm_and_si128(take, x), _mm_andnot_si128(take, m));
+    }
+    alignas(16) int32_t l[4];
+    _mm_store_si128(reinterpret_cast<__m128i*>(l), m);
+    int32_t r = Max ? maxScalar(l, 4) : minScalar(l, 4);
+    for (; i < n; ++i) r = Max ? std::max(r, s[i]) : std::min(r, s[i]);
+    return r;
+}
+int32_t minSse2(const int32_t* s, size_t n) { return extremeSse2<false>(s, n); }
+int32_t maxSse2(const int32_t* s, size_t n) { return extremeSse2<true>(s, n); }
+
+const VectorKernels SSE2 = {"sse2", addSse2, fillSse2, sumSse2, countSse2, minSse2, maxSse2};
+#define VM_VECTOR_SSE2 1
+#else
+#define VM_VECTOR_SSE2 0
+#endif
+
+#if VM_VECTOR_X86
+// --- AVX2: 8 cells a step ---
+#define AVX2 __attribute__((target("avx2")))
+
+AVX2 void addAvx2(int32_t* d, const int32_t* s, size_t n) {
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(d + i));
+        __m256i y = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(s + i));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(d + i), _mm256_add_epi32(x, y));
+    }
+    addScalar(d + i, s + i, n - i);
+}
+AVX2 void fillAvx2(int32_t* d, size_t n, int32_t v) {
+    const __m256i x = _mm256_set1_epi32(v);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) _mm256_storeu_si256(reinterpret_cast<__m256i*>(d + i), x);
+    fillScalar(d + i, n - i, v);
+}
+AVX2 int32_t lanesAvx2(__m256i x) {
+    alignas(32) int32_t l[8];
+    _mm256_store_si256(reinterpret_cast<__m256i*>(l), x);
+    return sumScalar(l, 8);
+}
+AVX2 int32_t sumAvx2(const int32_t* s, size_t n) {
+    __m256i t = _mm256_setzero_si256();
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) t = _mm256_add_epi32(t, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(s + i)));
+    return int32_t(uint32_t(lanesAvx2(t)) + uint32_t(sumScalar(s + i, n - i)));
+}
+AVX2 int32_t countAvx2(const int32_t* s, size_t n, int32_t v) {
+    const __m256i key = _mm256_set1_epi32(v);
+    __m256i t = _mm256_setzero_si256();
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8)
+        t = _mm256_sub_epi32(t, _mm256_cmpeq_epi32(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(s + i)), key));
+    return lanesAvx2(t) + countScalar(s + i, n - i, v);
+}
+template <bool Max>
+AVX2 int32_t extremeAvx2(const int32_t* s, size_t n) {
+    if (n < 8) return Max ? maxScalar(s, n) : minScalar(s, n);
+    __m256i m = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(s));
+    size_t i = 8;
+    for (; i + 8 <= n; i += 8) {
+        __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(s + i));
+        m = Max ? _mm256_max_epi32(m, x) : _mm256_min_epi32(m, x);
+    }
+    alignas(32) int32_t l[8];
+    _mm256_store_si256(reinterpret_cast<__m256i*>(l), m);
+    int32_t r = Max ? maxScalar(l, 8) : minScalar(l, 8);
+    for (; i < n; ++i) r = Max ? std::max(r, s[i]) : std::min(r, s[i]);
+    return r;
+}
+AVX2 int32_t minAvx2(const int32_t* s, size_t n) { return extremeAvx2<false>(s, n); }
+AVX2 int32_t maxAvx2(const int32_t* s, size_t n) { return extremeAvx2<true>(s, n); }
+#undef AVX2
+
+const VectorKernels AVX2_SET = {"avx2", addAvx2, fillAvx2, sumAvx2, countAvx2, minAvx2, maxAvx2};
+
+bool hasAvx2() {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+}
+#endif
+
+const VectorKernels* detect() {
+#if VM_VECTOR_X86
+    if (hasAvx2()) return &AVX2_SET;
+#endif
+#if VM_VECTOR_SSE2
+    return &SSE2;
+#else
+    return &SCALAR;
+#endif
+}
+
+std::atomic<const VectorKernels*> chosen{nullptr};  // null: detect()'s pick
+
+// Calls f(cells, length) for each contiguous piece of [src, src+n); cells
+// is null for a piece that is all 0.
+template <class F>
+void eachSpan(const Memory& m, uint64_t src, uint64_t n, F f) {
+    while (n) {
+        uint64_t len = n;
+        const int32_t* p = m.readSpan(src, len);
+        f(p, len);
+        src += len;
+        n -= len;
+    }
+}
+
+template <bool Max>
+int32_t blockExtreme(const Memory& m, uint64_t src, uint64_t n) {
+    const VectorKernels& k = vectorKernels();
+    bool first = true;
+    int32_t r = 0;
+    eachSpan(m, src, n, [&](const int32_t* p, uint64_t len) {
+        int32_t v = !p ? 0 : Max ? k.max(p, len) : k.min(p, len);
+        r = first ? v : Max ? std::max(r, v) : std::min(r, v);
+        first = false;
+    });
+    return r;
+}
+
+}  // namespace
+
+const VectorKernels& vectorKernels() {
+    static const VectorKernels* const detected = detect();
+    const VectorKernels* k = chosen.load(std::memory_order_relaxed);
+    return k ? *k : *detected;
+}
+
+bool selectVectorKernels(const std::string& name) {
+    const VectorKernels* k = nullptr;
+    if (name == "auto") {
+        chosen.store(nullptr, std::memory_order_relaxed);
+        return true;
+    }
+    if (name == "scalar") k = &SCALAR;
+#if VM_VECTOR_SSE2
+    if (name == "sse2") k = &SSE2;
+#endif
+#if VM_VECTOR_X86
+    if (name == "avx2" && hasAvx2()) k = &AVX2_SET;
+#endif
+    if (!k) return false;
+    chosen.store(k, std::memory_order_relaxed);
+    return true;
+}
+
+void blockAdd(Memory& m, uint64_t dst, uint64_t src, uint64_t n) {
+    const VectorKernels& k = vectorKernels();
+    while (n) {
+        uint64_t len = n;
+        const int32_t* s = m.readSpan(src, len);
+        if (s) {
+            int32_t* d = m.writeSpan(dst, len);
+            k.add(d, s, len);
+        } else {
+            uint64_t skip = len;  // adding 0s: step over the shorter piece
+            m.readSpan(dst, skip);
+            len = skip;
+        }
+        dst += len; src += len; n -= len;
+    }
+}
+
+void blockFill(Memory& m, uint64_t dst, uint64_t n, int32_t v) {
+    const VectorKernels& k = vectorKernels();
+    while (n) {
+        uint64_t len = n;
+        if (v || m.readSpan(dst, len)) {  // else already 0: leave it unallocated
+            int32_t* d = m.writeSpan(dst, len);
+            k.fill(d, len, v);
+        }
+        dst += len; n -= len;
+    }
+}
+
+void blockCopy(Memory& m, uint64_t dst, uint64_t src, uint64_t n) {
+    if (!m.paged()) {
+        uint64_t all = n;
+        std::memmove(m.writeSpan(dst, all), m.readSpan(src, all), n * sizeof(int32_t));
+        return;
+    }
+    // paged ranges that overlap go through a temporary, so a piece is never
+    // read after another piece has overwritten it
+    if (dst < src + n && src < dst + n) {
+        std::vector<int32_t> cells(n);
+        uint64_t at = 0;
+        eachSpan(m, src, n, [&](const int32_t* p, uint64_t len) {
+            if (p) std::memcpy(&cells[at], p, len * sizeof(int32_t));
+            at += len;
+        });
+        for (at = 0; at < n; ) {
+            uint64_t len = n - at;
+            int32_t* d = m.writeSpan(dst + at, len);
+            std::memcpy(d, &cells[at], len * sizeof(int32_t));
+            at += len;
+        }
+        return;
+    }
+    while (n) {
+        uint64_t len = n;
+        const int32_t* s = m.readSpan(src, len);
+        if (s) {
+            int32_t* d = m.writeSpan(dst, len);
+            std::memcpy(d, s, len * sizeof(int32_t));
+        } else if (m.readSpan(dst, len)) {
+            int32_t* d = m.writeSpan(dst, len);
+            std::fill(d, d + len, 0);
+        }
+        dst += len; src += len; n -= len;
+    }
+}
+
+int32_t blockSum(const Memory& m, uint64_t src, uint64_t n) {
+    const VectorKernels& k = vectorKernels();
+    uint32_t t = 0;
+    eachSpan(m, src, n, [&](const int32_t* p, uint64_t len) { if (p) t += uint32_t(k.sum(p, len)); });
+    return int32_t(t);
+}
+
+int32_t blockCount(const Memory& m, uint64_t src, uint64_t n, int32_t v) {
+    const VectorKernels& k = vectorKernels();
+    int64_t t = 0;
+    eachSpan(m, src, n, [&](const int32_t* p, uint64_t len) { t += p ? k.count(p, len, v) : v == 0 ? int64_t(len) : 0; });
+    return int32_t(t);
+}
+
+int32_t blockMin(const Memory& m, uint64_t src, uint64_t n) { return blockExtreme<false>(m, src, n); }
+int32_t blockMax(const Memory& m, uint64_t src, uint64_t n) { return blockExtreme<true>(m, src, n); }
@@ -0,0 +1,41 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include "Memory.h"
+
+// Host kernels for the block memory ops (VADD, VFILL, VCOPY, VSUM, VCNT,
+// VMIN, VMAX). There is a scalar set, an SSE2 set and an AVX2 set; the
+// best one the CPU has is picked the first time it is asked for, so a
+// block op costs one interpreter dispatch and one indirect call however
+// many cells it covers. int32 arithmetic wraps, in every set.
+struct VectorKernels {
+    const char* name;  // "avx2", "sse2" or "scalar"
+    void (*add)(int32_t* dst, const int32_t* src, size_t n);  // dst[i] += src[i]
+    void (*fill)(int32_t* dst, size_t n, int32_t v);
+    int32_t (*sum)(const int32_t* src, size_t n);
+    int32_t (*count)(const int32_t* src, size_t n, int32_t v);  // cells equal to v
+    int32_t (*min)(const int32_t* src, size_t n);              // n > 0
+    int32_t (*max)(const int32_t* src, size_t n);              // n > 0
+};
+
+const VectorKernels& vectorKernels();
+// "auto" (the best available), "avx2", "sse2" or "scalar"; false, and
+// nothing changed, if the name is unknown or this CPU or build lacks it.
+// Meant for start-up (--simd) and tests. The choice is process-wide and
+// read at every block op, so machines already running switch at their
+// next one; an op under way finishes with the set it started with. Every
+// set gives the same results.
+bool selectVectorKernels(const std::string& name);
+
+// The block ops on VM memory, flat or paged; the ranges were checked
+// against the program's memory size at load. A paged range is worked
+// through page by page; pages never written read as 0 and are only
+// allocated when a cell in them is written.
+void blockAdd(Memory& m, uint64_t dst, uint64_t src, uint64_t n);  // ranges equal or disjoint
+void blockFill(Memory& m, uint64_t dst, uint64_t n, int32_t v);
+void blockCopy(Memory& m, uint64_t dst, uint64_t src, uint64_t n);  // ranges may overlap
+int32_t blockSum(const Memory& m, uint64_t src, uint64_t n);
+int32_t blockCount(const Memory& m, uint64_t src, uint64_t n, int32_t v);
+int32_t blockMin(const Memory& m, uint64_t src, uint64_t n);
+int32_t blockMax(const Memory& m, uint64_t src, uint64_t n);
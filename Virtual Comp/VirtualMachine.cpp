@@ -1,78 +1,47 @@
 #include "VirtualMachine.h"
+#include "Asm.h"
+#include "Vector.h"
 #include <stack>
 #include <vector>
 #include <iostream>
-
-enum Opcodes {
-    OP_PUSH     = 0x01,
-    OP_MOV      = 0x02,
-    OP_ADDR     = 0x03,
-    OP_SUBR     = 0x04,
-    OP_LOADR    = 0x05,
-    OP_STORER   = 0x06,
-    OP_PRINT    = 0x07,
-    OP_PRINTR   = 0x08,
-    OP_CMP      = 0x09,
-    OP_JEQ      = 0x0A,
-    OP_JNE      = 0x0B,
-    OP_JGT      = 0x0C,
-    OP_JLT      = 0x0D,
-    OP_LOADM    = 0x0E,
-    OP_STOREM   = 0x0F,
-    OP_LOADMR   = 0x10,
-    OP_STOREMR  = 0x11,
-    OP_DECR     = 0x12,
-    OP_CPRINT   = 0x13,
-    OP_CEASE    = 0x14
-};
-
-const char* VirtualMachine::opcodeName(uint8_t op) const {
-    switch (op) {
-        case OP_PUSH: return "PUSH";
-        case OP_MOV: return "MOV";
-        case OP_ADDR: return "ADDR";
-        case OP_SUBR: return "SUBR";
-        case OP_LOADR: return "LOADR";
-        case OP_STORER: return "STORER";
-        case OP_PRINT: return "PRINT";
-        case OP_PRINTR: return "PRINTR";
-        case OP_CMP: return "CMP";
-        case OP_JEQ: return "JEQ";
-        case OP_JNE: return "JNE";
-        case OP_JGT: return "JGT";
-        case OP_JLT: return "JLT";
-        case OP_LOADM: return "LOADM";
-        case OP_STOREM: return "STOREM";
-        case OP_LOADMR: return "LOADMR";
-        case OP_STOREMR: return "STOREMR";
-        case OP_DECR: return "DECR";
-        case OP_CPRINT: return "CPRINT";
-        case OP_CEASE: return "CEASE";
-        default: return "???";
-    }
-}
+#include <algorithm>
+#include <map>
+#include <cctype>
+#include <iomanip>
+#include <chrono>
+
+// Dispatch strategy is picked at build time: GCC/Clang get a computed-goto
+// threaded loop, everything else (or -DVM_DISPATCH_SWITCH) gets a switch.
+#if !defined(VM_DISPATCH_SWITCH) && (defined(__GNUC__) || defined(__clang__))
+#define VM_COMPUTED_GOTO 1
+#else
+#define VM_COMPUTED_GOTO 0
+#endif
+
+// The profiler (--profile) is built in unless -DVM_NO_PROFILE. Either way
+// runs without it never touch profiling code: profiled runs get their own
+// interpreter instantiations.
+#if defined(VM_NO_PROFILE)
+#define VM_PROFILE 0
+#else
+#define VM_PROFILE 1
+#endif
+
+// Integer arithmetic on registers, COUNTER and the operand stack: 32-bit,
+// wrapping, like the JIT's code and the block kernels. Division truncates
+// toward zero; INT_MIN / -1 wraps to INT_MIN (remainder 0) rather than
+// trapping as the host's would. Callers have ruled out dividing by 0.
+static inline int32_t wrapAdd(int32_t a, int32_t b) { return int32_t(uint32_t(a) + uint32_t(b)); }
+static inline int32_t wrapSub(int32_t a, int32_t b) { return int32_t(uint32_t(a) - uint32_t(b)); }
+static inline int32_t wrapMul(int32_t a, int32_t b) { return int32_t(uint32_t(a) * uint32_t(b)); }
+static inline int32_t wrapDiv(int32_t a, int32_t b) { return b == -1 ? int32_t(0u - uint32_t(a)) : a / b; }
+static inline int32_t wrapMod(int32_t a, int32_t b) { return b == -1 ? 0 : a % b; }
 
 void VirtualMachine::printInstruction(const Instruction& ins) const {
     // show 1-based PC to match your assembler/jump semantics
-    std::cout << "PC " << (pc + 1) << ": " << opcodeName(ins.opcode)
+    std::cout << "PC " << (pc + 1) << ": " << Program::opcodeName(ins.opcode)
               << " " << int(ins.a) << " " << int(ins.b) << " " << int(ins.c) << "\n";
-    if (explain) {
-        // a few human-friendly hints (expand as you like)
-        switch (ins.opcode) {
-            case OP_MOV:    std::cout << "  -> R" << int(ins.a) << " = " << int(ins.b) << "\n"; break;
-            case OP_ADDR:   std::cout << "  -> R" << int(ins.a) << " = R" << int(ins.b) << " + R" << int(ins.c) << "\n"; break;
-            case OP_LOADMR: std::cout << "  -> R" << int(ins.a) << " = MEM[" << int(ins.b) << "]\n"; break;
-            case OP_STOREMR:std::cout << "  -> MEM[" << int(ins.a) << "] = R" << int(ins.b) << "\n"; break;
-            case OP_CMP:    std::cout << "  -> set flags by comparing "
-                                      << ((ins.a==0xFF) ? "COUNTER" : ("R"+std::to_string(ins.a)))
-                                      << " vs "
-                                      << ((ins.b==0xFF) ? "COUNTER" : ("R"+std::to_string(ins.b))) << "\n"; break;
-            case OP_JEQ:    std::cout << "  -> jump if EQ to line " << int(ins.a) << "\n"; break;
-            case OP_JGT:    std::cout << "  -> jump if GT to line " << int(ins.a) << "\n"; break;
-            case OP_JLT:    std::cout << "  -> jump if LT to line " << int(ins.a) << "\n"; break;
-            default: break;
-        }
-    }
+    if (explain) Program::explain(std::cout, ins);
 }
 
 
@@ -89,53 +58,88 @@ void VirtualMachine::printState() const {
         std::cout << stack[i] << (i+1<stack.size()?", ":"");
     }
     std::cout << "]\n";
+    if (!returns.empty()) {
+        // as the lines each CALL returns to, outermost first
+        std::cout << "CALLS: [";
+        for (size_t i = 0; i < returns.size(); ++i)
+            std::cout << returns[i] + 1 << (i+1<returns.size()?", ":"");
+        std::cout << "]\n";
+    }
 
     // show a small memory window (non-zero cells) for clarity
-    bool any=false;
-    for (size_t i = 0; i < memory.size(); ++i) {
-        if (memory[i] != 0) { any=true; break; }
-    }
-    if (any) {
-        std::cout << "MEM (non-zero): ";
-        bool first=true;
-        for (size_t i = 0; i < memory.size(); ++i) {
-            if (memory[i] != 0) {
-                if (!first) std::cout << " | ";
-                std::cout << "[" << i << "]=" << memory[i];
-                first=false;
-            }
-        }
-        std::cout << "\n";
-    }
+    bool first=true;
+    memory.forEachNonZero([&](uint64_t i, int32_t v) {
+        std::cout << (first ? "MEM (non-zero): " : " | ") << "[" << i << "]=" << v;
+        first=false;
+    });
+    if (!first) std::cout << "\n";
 }
 
 
 void VirtualMachine::runBytecodeStep() {
-    auto at_breakpoint = [this]() {
-        int one_based_pc = pc + 1;
-        return breakpoints.count(one_based_pc) > 0;
-    };
+    if (!program) return;
+    const Program::Bytecode& bytecode = program->bytecode;
 
-    auto exec_one = [this]() {
+    // runs one instruction; true if it changed a watched location
+    std::vector<int32_t> before;
+    auto exec_one = [&]() {
         const Instruction& instr = bytecode[pc];
         if (trace) printInstruction(instr);
 
-        auto it = dispatch.find(instr.opcode);
-        if (it != dispatch.end()) it->second(instr);
-        else std::cerr << "Unknown opcode: 0x" << std::hex << int(instr.opcode) << std::dec << "\n";
+        const int line = pc;
+        const bool watched = !debugOps.empty() && (debugOps[pc].flags & OPF_WATCH);
+        if (watched) {
+            before.clear();
+            for (const DebugValue& w : watches) before.push_back(debugValue(w));
+        }
+        recordStep();
+        interpret(program->ops, OPF_STEP);  // runs one decoded op and moves pc on
+        output().flush();     // keep program output in order with the REPL
+        if (!watched) return false;
+
+        bool changed = false;
+        for (size_t i = 0; i < watches.size(); ++i) {
+            int32_t now = debugValue(watches[i]);
+            if (now == before[i]) continue;
+            std::cout << "[WATCH] " << describe(watches[i]) << ": " << before[i] << " -> " << now
+                      << " (line " << (line + 1) << ")\n";
+            changed = true;
+        }
+        return changed;
     };
 
-    auto disasm_one = [this](int i) {
+    auto disasm_one = [&](int i) {
         const Instruction& ins = bytecode[i];
-        std::cout << (i+1) << ": " << opcodeName(ins.opcode)
+        std::cout << (i+1) << ": " << Program::opcodeName(ins.opcode)
                   << " " << int(ins.a) << " " << int(ins.b) << " " << int(ins.c) << "\n";
     };
 
+    // after moving back or forward in time: where we are now
+    auto show_position = [&]() {
+        std::cout << "[" << executed << " instructions run]\n";
+        if (pc < (int)bytecode.size()) printInstruction(bytecode[pc]);
+        printState();
+    };
+
+    std::map<std::string, Snapshot> saved;  // by name, from `snapshot`
+    executed = 0;
+    faulted = false;
+    stack.clear();  // as in runBytecode()
+    returns.clear();
+    if (!stackFits(*program, nullptr)) {
+        faulted = true;
+        return;
+    }
+    clearHistory();
+    compileDebugPoints();
+
     std::cout << "Stepper started. Type 'help' for commands.\n";
 
+    bool pause = false;  // a watchpoint fired, or cont reached a breakpoint
     for (pc = 0; pc < (int)bytecode.size(); /* pc advanced in loop */) {
         // Pause if at breakpoint or at the beginning
-        if (at_breakpoint() || pc == 0) {
+        if (pause || pc == 0 || breakHere(true)) {
+            pause = false;
             // Show current instruction and state
             printInstruction(bytecode[pc]);
             printState();
@@ -154,28 +158,114 @@ void VirtualMachine::runBytecodeStep() {
                 if (t == "mem")  { int s,n; if (iss>>s>>n) dumpMem(s,n); else std::cout<<"usage: mem <start> <n>\n"; continue; }
                 if (t == "bp") {
                     std::string sub; iss>>sub;
-                    if (sub=="add"){ int n; if (iss>>n){ addBreakpoint(n); std::cout<<"added bp at "<<n<<"\n"; } else std::cout<<"usage: bp add <n>\n"; }
-                    else if (sub=="del"){ int n; if (iss>>n){ breakpoints.erase(n); std::cout<<"removed bp "<<n<<"\n"; } else std::cout<<"usage: bp del <n>\n"; }
-                    else if (sub=="list"){ if (breakpoints.empty()) std::cout<<"(none)\n"; else { for(int b:breakpoints) std::cout<<b<<" "; std::cout<<"\n"; } }
-                    else if (sub=="clear"){ breakpoints.clear(); std::cout<<"All breakpoints cleared.\n"; }
+                    if (sub=="add"){
+                        // bp add <n> [if <a> <op> <b>] [hits <k>]
+                        int n; Breakpoint bp; std::string word; bool ok = bool(iss>>n) && n > 0;
+                        while (ok && iss >> word) {
+                            if (word == "if") {
+                                bp.conditional = true;
+                                ok = parseDebugValue(iss, bp.lhs) && (iss >> bp.cmp) && parseDebugValue(iss, bp.rhs)
+                                  && (bp.cmp=="=="||bp.cmp=="!="||bp.cmp=="<"||bp.cmp=="<="||bp.cmp==">"||bp.cmp==">=");
+                            } else if (word == "hits") {
+                                ok = (iss >> bp.from) && bp.from > 0;
+                            } else {
+                                ok = false;
+                            }
+                        }
+                        if (ok) { addBreakpoint(n, bp); std::cout<<"added bp at "<<n<<"\n"; }
+                        else std::cout<<"usage: bp add <n> [if <a> ==|!=|<|<=|>|>= <b>] [hits <k>]\n";
+                    }
+                    else if (sub=="del"){ int n; if (iss>>n){ breakpoints.erase(n); compileDebugPoints(); std::cout<<"removed bp "<<n<<"\n"; } else std::cout<<"usage: bp del <n>\n"; }
+                    else if (sub=="list"){
+                        if (breakpoints.empty()) std::cout<<"(none)\n";
+                        for (const auto& b : breakpoints) {
+                            std::cout << b.first;
+                            if (b.second.conditional)
+                                std::cout << " if " << describe(b.second.lhs) << " " << b.second.cmp << " " << describe(b.second.rhs);
+                            if (b.second.from > 1) std::cout << " hits " << b.second.from;
+                            std::cout << "  (hit " << b.second.hits << ")\n";
+                        }
+                    }
+                    else if (sub=="clear"){ breakpoints.clear(); compileDebugPoints(); std::cout<<"All breakpoints cleared.\n"; }
                     else std::cout<<"usage: bp [add|del|list|clear] ...\n";
                     continue;
                 }
+                if (t == "watch") {
+                    // watch <R0-R7|COUNTER|mem n> | watch del <...> | watch list | watch clear
+                    std::string sub; std::streampos at = iss.tellg(); iss >> sub;
+                    DebugValue w;
+                    if (sub=="list") {
+                        if (watches.empty()) std::cout<<"(none)\n";
+                        for (const DebugValue& v : watches) std::cout << describe(v) << " = " << debugValue(v) << "\n";
+                    } else if (sub=="clear") {
+                        watches.clear(); compileDebugPoints(); std::cout<<"All watchpoints cleared.\n";
+                    } else if (sub=="del") {
+                        if (!parseDebugValue(iss, w)) { std::cout<<"usage: watch del <what>\n"; continue; }
+                        auto same = [&](const DebugValue& v) { return v.kind == w.kind && v.n == w.n; };
+                        watches.erase(std::remove_if(watches.begin(), watches.end(), same), watches.end());
+                        compileDebugPoints();
+                        std::cout << "removed watch " << describe(w) << "\n";
+                    } else {
+                        iss.clear(); iss.seekg(at);
+                        if (parseDebugValue(iss, w) && addWatch(w)) std::cout << "watching " << describe(w) << "\n";
+                        else std::cout<<"usage: watch <R0-R7|COUNTER|mem n>\n";
+                    }
+                    continue;
+                }
                 if (t == "trace"){ std::string on; iss>>on; if(on=="on")trace=true; else if(on=="off")trace=false; else std::cout<<"usage: trace on|off\n"; continue; }
                 if (t == "explain"){ std::string on; iss>>on; if(on=="on")explain=true; else if(on=="off")explain=false; else std::cout<<"usage: explain on|off\n"; continue; }
                 if (t == "disasm"){ disassemble(); continue; }
+                if (t == "snapshot") {
+                    std::string name = "default"; iss >> name;
+                    saved[name] = snapshot();
+                    std::cout << "saved '" << name << "' at line " << (pc + 1) << "\n";
+                    continue;
+                }
+                if (t == "restore") {
+                    std::string name = "default"; iss >> name;
+                    auto it = saved.find(name);
+                    if (it == saved.end()) { std::cout << "no snapshot '" << name << "'\n"; continue; }
+                    restore(it->second);
+                    undoSize = 0;  // the undo records were for another path here
+                    printInstruction(bytecode[pc]);
+                    printState();
+                    continue;
+                }
+                if (t == "rstep" || t == "rs") {
+                    int n = 1; iss >> n;
+                    int undone = 0;
+                    while (undone < n && stepBack()) ++undone;
+                    if (undone < n) std::cout << "at the start\n";
+                    show_position();
+                    continue;
+                }
+                if (t == "rcont" || t == "rc") {
+                    if (!reverseToBreakpoint()) std::cout << "no breakpoint earlier; at the start\n";
+                    show_position();
+                    continue;
+                }
+                if (t == "goto") {
+                    uint64_t n;
+                    if (!(iss >> n)) { std::cout << "usage: goto <instruction count>\n"; continue; }
+                    travelTo(n);
+                    if (executed < n) std::cout << "the program ends after " << executed << " instructions\n";
+                    show_position();
+                    continue;
+                }
 
                 if (t == "step" || t == "s") {
-                    exec_one();
-                    // advance pc unless handler changed it (jumps already set pc)
-                    ++pc;
+                    if (pc < (int)bytecode.size()) pause = exec_one();
                     break; // leave REPL to re-check bp and show next state
                 }
                 if (t == "cont" || t == "c") {
-                    // run until breakpoint or end
-                    while (pc < (int)bytecode.size() && !at_breakpoint()) {
-                        exec_one();
-                        ++pc;
+                    // run until a breakpoint, a watchpoint or the end; the
+                    // line we are stopped at runs first. Between debug
+                    // points it runs at full speed unless tracing.
+                    if (pc < (int)bytecode.size()) pause = exec_one();
+                    while (!pause && pc < (int)bytecode.size()) {
+                        if (breakHere(true)) pause = true;
+                        else if (trace || (!debugOps.empty() && (debugOps[pc].flags & OPF_WATCH))) pause = exec_one();
+                        else continueFast();
                     }
                     break; // will re-show state at next loop
                 }
@@ -185,29 +275,363 @@ void VirtualMachine::runBytecodeStep() {
             }
         } else {
             // Not at breakpoint: single-step automatically
-            exec_one();
-            ++pc;
+            pause = exec_one();
+        }
+    }
+}
+
+
+// --- stepper history ---
+// Before each stepped instruction, recordStep() saves pc, the flags and
+// whatever single register, counter, memory cell or stack slot that
+// instruction is about to change (a block op's whole range of cells goes
+// to undoCells), so stepBack() can put it back. Every
+// checkpointEvery instructions it also keeps a snapshot (pages are shared,
+// see Memory), so a point older than the ring is rebuilt by restoring the
+// checkpoint before it and running forward with output dropped. Past
+// MAX_CHECKPOINTS every other checkpoint is dropped and the interval
+// doubles, so memory stays bounded however long the session runs.
+
+static constexpr size_t MAX_CHECKPOINTS = 64;
+static constexpr uint64_t FIRST_CHECKPOINT_EVERY = 4096;
+
+void VirtualMachine::clearHistory() {
+    undoRing.clear();
+    undoRing.reserve(historyLimit);  // address space only; pages are touched as the ring fills
+    undoHead = undoSize = 0;
+    undoCells.clear();
+    checkpoints.clear();
+    checkpointEvery = FIRST_CHECKPOINT_EVERY;
+    nextCheckpoint = 0;
+}
+
+void VirtualMachine::checkpoint() {
+    if (executed < nextCheckpoint) return;
+    if (checkpoints.empty() || checkpoints.back().executed < executed) {
+        checkpoints.push_back(snapshot());
+        if (checkpoints.size() > MAX_CHECKPOINTS) {
+            size_t kept = 0;
+            for (size_t i = 0; i < checkpoints.size(); i += 2) checkpoints[kept++] = std::move(checkpoints[i]);
+            checkpoints.resize(kept);
+            checkpointEvery *= 2;
+        }
+    }
+    nextCheckpoint = checkpoints.back().executed + checkpointEvery;
+}
+
+void VirtualMachine::recordStep() {
+    checkpoint();
+    if (!historyLimit) return;
+
+    const Op& op = program->ops[pc];
+    UndoRecord r{pc, UNDO_NONE, uint8_t(flag_eq | flag_gt << 1 | flag_lt << 2), 0, 0, 0};
+    switch (op.code) {
+        case X_MOV: case X_ADDR: case X_SUBR: case X_LOADMR:
+        case X_VSUM: case X_VCNT: case X_VMIN: case X_VMAX:
+        case X_MULR: case X_DIVR: case X_MODR: case X_ANDR: case X_ORR: case X_XORR: case X_SHLR: case X_SHRR: case X_SARR:
+        case X_ADDI: case X_MULI: case X_DIVI: case X_MODI: case X_ANDI: case X_ORI: case X_XORI: case X_SHLI: case X_SHRI:
+        case X_SARI: case X_INC: case X_DEC:
+            r.kind = UNDO_REG; r.index = op.a; r.old = registers[op.a];
+            break;
+        case X_DECR: case X_LOADC: case X_INCC:
+            r.kind = UNDO_COUNTER; r.old = counter;
+            break;
+        case X_STOREMR: case X_SETM:
+            r.kind = UNDO_MEM; r.index = op.a; r.old = memory.load(op.a);
+            break;
+        case X_VADD: case X_VFILL: case X_VCOPY: {
+            r.kind = UNDO_CELLS; r.index = op.a;
+            if (!undoSize) undoCells.clear();  // left over from a history since dropped
+            std::vector<int32_t>& cells = undoCells.emplace_back(op.c);
+            for (int32_t i = 0; i < op.c; ++i) cells[i] = memory.load(uint64_t(op.a) + i);
+            break;
+        }
+        case X_PUSH: case X_LOADR: case X_LOADM:
+            if (!stack.full()) r.kind = UNDO_PUSH;
+            break;
+        case X_DUP:
+            if (!stack.empty() && !stack.full()) r.kind = UNDO_PUSH;
+            break;
+        case X_CALL:
+            if (!returns.full()) r.kind = UNDO_CALL;
+            break;
+        case X_RET:
+            if (!returns.empty()) { r.kind = UNDO_RET; r.old = returns.top(); }
+            break;
+        case X_ADD: case X_SUB: case X_MUL:
+            if (stack.size() >= 2) { r.kind = UNDO_BINARY; r.old = stack[stack.size() - 2]; r.popped = stack.top(); }
+            break;
+        case X_JZ: case X_JNZ:
+            if (!stack.empty()) { r.kind = UNDO_POP; r.popped = stack.top(); }
+            break;
+        case X_STORER:
+            if (!stack.empty()) { r.kind = UNDO_POP_REG; r.index = op.a; r.old = registers[op.a]; r.popped = stack.top(); }
+            break;
+        case X_STOREM:
+            if (!stack.empty()) { r.kind = UNDO_POP_MEM; r.index = op.a; r.old = memory.load(op.a); r.popped = stack.top(); }
+            break;
+        default:  // compares and jumps change only flags and pc; the rest nothing
+            break;
+    }
+    if (undoHead == undoRing.size()) {
+        undoRing.push_back(r);  // the ring fills lazily
+    } else {
+        // a full ring overwrites its oldest record, whose saved cells are
+        // the oldest held
+        if (undoSize == historyLimit && undoRing[undoHead].kind == UNDO_CELLS) undoCells.pop_front();
+        undoRing[undoHead] = r;
+    }
+    if (++undoHead == historyLimit) undoHead = 0;
+    undoSize = std::min(undoSize + 1, historyLimit);
+}
+
+bool VirtualMachine::stepBack() {
+    if (!undoSize) {
+        if (!executed || checkpoints.empty()) return false;
+        travelTo(executed - 1);
+        return true;
+    }
+    undoHead = (undoHead ? undoHead : historyLimit) - 1;
+    --undoSize;
+    const UndoRecord& r = undoRing[undoHead];
+    switch (r.kind) {
+        case UNDO_REG:     registers[r.index] = r.old; break;
+        case UNDO_COUNTER: counter = r.old; break;
+        case UNDO_MEM:     memory.store(r.index, r.old); break;
+        case UNDO_PUSH:    stack.pop(); break;
+        case UNDO_POP_REG: registers[r.index] = r.old; stack.push(r.popped); break;
+        case UNDO_POP_MEM: memory.store(r.index, r.old); stack.push(r.popped); break;
+        case UNDO_POP:     stack.push(r.popped); break;
+        case UNDO_BINARY:  stack.top() = r.old; stack.push(r.popped); break;
+        case UNDO_CALL:    returns.pop(); break;
+        case UNDO_RET:     returns.push(r.old); break;
+        case UNDO_CELLS: {
+            const std::vector<int32_t>& cells = undoCells.back();
+            for (size_t i = 0; i < cells.size(); ++i) memory.store(uint64_t(r.index) + i, cells[i]);
+            undoCells.pop_back();
+            break;
         }
+        default: break;
     }
+    pc = r.pc;
+    flag_eq = r.flags & 1; flag_gt = r.flags & 2; flag_lt = r.flags & 4;
+    --executed;
+    return true;
 }
 
+void VirtualMachine::travelTo(uint64_t count) {
+    if (count < executed && executed - count > undoSize && !checkpoints.empty()) {
+        // further back than the ring reaches
+        auto at = std::upper_bound(checkpoints.begin(), checkpoints.end(), count,
+                                   [](uint64_t n, const Snapshot& c) { return n < c.executed; });
+        restore(*(at - 1));
+        undoSize = 0;
+    }
+    while (executed > count && stepBack()) {}
+    replayTo(count);
+}
 
-void VirtualMachine::disassemble() const {
+// Runs forward, recording history but printing nothing, until `count`
+// instructions have run or the program ends. With lastBreak, also notes
+// the last instruction count (below `count`) at which a breakpoint's line
+// was about to run.
+void VirtualMachine::replayTo(uint64_t count, uint64_t* lastBreak) {
+    OutputSink* shown = out;
+    NullSink discard;
+    out = &discard;
+    const int n = (int)program->bytecode.size();
+    while (executed < count && pc < n) {
+        if (lastBreak && breakHere(false)) *lastBreak = executed;
+        recordStep();
+        interpret(program->ops, OPF_STEP);
+    }
+    out = shown;
+}
+
+// The stepper's cont between debug points: runs from pc on the threaded
+// interpreter until a line flagged OPF_BREAK or OPF_WATCH is next, the
+// program ends or the next checkpoint is due. With no debug points it runs
+// the fused stream, which has neither flag. It keeps no undo records, so
+// the ring is dropped and going back replays from the checkpoints, which
+// keep coming at their usual interval.
+void VirtualMachine::continueFast() {
+    checkpoint();
+    undoSize = 0;
+    runLimit = nextCheckpoint - executed;
+    interpret(debugOps.empty() ? program->fused : debugOps, OPF_BREAK | OPF_WATCH);
+    runLimit = UINT64_MAX;
+    output().flush();
+}
+
+// Goes back to the last point a breakpoint was hit before this one: first
+// through the ring, then by replaying each checkpoint interval, newest
+// first. Ends at the start if there is none.
+bool VirtualMachine::reverseToBreakpoint() {
+    while (undoSize) {
+        stepBack();
+        if (breakHere(false)) return true;
+    }
+    uint64_t end = executed;
+    for (size_t c = checkpoints.size(); c-- > 0; ) {
+        if (checkpoints[c].executed >= end) continue;
+        restore(checkpoints[c]);
+        undoSize = 0;
+        uint64_t found = UINT64_MAX;
+        replayTo(end, &found);
+        if (found != UINT64_MAX) {
+            travelTo(found);
+            return true;
+        }
+        end = checkpoints[c].executed;
+    }
+    travelTo(0);
+    return false;
+}
+
+
+void VirtualMachine::disassemble(std::ostream& os, const Profile* hits) const {
+    if (!program) return;
+    const Program::Bytecode& bytecode = program->bytecode;
+    const std::vector<Program::Fusion>& fusions = program->fusions;
+    std::multimap<int, const std::string*> labels;
+    for (const Program::Symbol& sym : program->symbols) labels.emplace(sym.line, &sym.name);
+    size_t f = 0;  // fusions are sorted by pc
     for (size_t i = 0; i < bytecode.size(); ++i) {
         const Instruction& ins = bytecode[i];
+        for (auto l = labels.equal_range((int)i); l.first != l.second; ++l.first)
+            os << (hits ? std::string(14, ' ') : "") << *l.first->second << ":\n";
+        if (hits) os << std::setw(12) << hits->hits[i] << "  ";
         // print 1-based address to match your assembler labels/jumps
-        std::cout << (i + 1) << ": " << opcodeName(ins.opcode)
-                  << " " << int(ins.a) << " " << int(ins.b) << " " << int(ins.c) << "\n";
+        os << (i + 1) << ": " << Program::opcodeName(ins.opcode)
+           << " " << int(ins.a) << " " << int(ins.b) << " " << int(ins.c);
+        if (f < fusions.size() && fusions[f].pc == (int)i) {
+            os << "    ; fused";
+            for (int k = 0; k < fusions[f].length; ++k)
+                os << (k ? "+" : " ") << Program::opcodeName(bytecode[i + k].opcode);
+            ++f;
+        }
+        const bool branch = (ins.opcode >= OP_JEQ && ins.opcode <= OP_JLT)
+                         || ins.opcode == OP_HZ || ins.opcode == OP_HNZ || ins.opcode == OP_CHNZ;
+        if (hits && branch && hits->hits[i])
+            os << "    ; taken " << hits->taken[i] << " of " << hits->hits[i];
+        os << "\n";
     }
 }
 
 
 void VirtualMachine::addBreakpoint(int one_based_pc) {
-    if (one_based_pc > 0) breakpoints.insert(one_based_pc);
+    addBreakpoint(one_based_pc, Breakpoint{});
+}
+void VirtualMachine::addBreakpoint(int one_based_pc, const Breakpoint& bp) {
+    if (one_based_pc <= 0) return;
+    breakpoints[one_based_pc] = bp;
+    compileDebugPoints();
 }
 void VirtualMachine::setBreakpoints(const std::vector<int>& bps) {
     breakpoints.clear();
-    for (int b : bps) if (b > 0) breakpoints.insert(b);
+    for (int b : bps) if (b > 0) breakpoints[b] = Breakpoint{};
+    compileDebugPoints();
+}
+
+bool VirtualMachine::addWatch(const DebugValue& what) {
+    if (what.kind == DebugValue::CONST) return false;
+    if (what.kind == DebugValue::REG && (what.n < 0 || what.n >= VM_REGISTERS)) return false;
+    if (what.kind == DebugValue::MEM && (what.n < 0 || uint64_t(what.n) >= memory.size())) return false;
+    watches.push_back(what);
+    compileDebugPoints();
+    return true;
+}
+
+bool VirtualMachine::parseDebugValue(std::istream& in, DebugValue& v) {
+    std::string t;
+    if (!(in >> t)) return false;
+    std::string up = t;
+    for (char& ch : up) ch = char(std::toupper((unsigned char)ch));
+    try {
+        if (up == "COUNTER") { v = {DebugValue::COUNTER, 0}; return true; }
+        if (up == "MEM") { v.kind = DebugValue::MEM; return bool(in >> v.n); }
+        if (up.size() > 5 && up.compare(0, 4, "MEM[") == 0 && up.back() == ']') {
+            v = {DebugValue::MEM, std::stoi(up.substr(4, up.size() - 5))};
+            return true;
+        }
+        if (up.size() == 2 && up[0] == 'R' && std::isdigit((unsigned char)up[1])) {
+            v = {DebugValue::REG, up[1] - '0'};
+            return true;
+        }
+        size_t used = 0;
+        v = {DebugValue::CONST, std::stoi(t, &used)};
+        return used == t.size();
+    } catch (const std::exception&) {
+        return false;
+    }
+}
+
+std::string VirtualMachine::describe(const DebugValue& v) {
+    switch (v.kind) {
+        case DebugValue::REG:     return "R" + std::to_string(v.n);
+        case DebugValue::COUNTER: return "COUNTER";
+        case DebugValue::MEM:     return "MEM[" + std::to_string(v.n) + "]";
+        default:                  return std::to_string(v.n);
+    }
+}
+
+int32_t VirtualMachine::debugValue(const DebugValue& v) const {
+    switch (v.kind) {
+        case DebugValue::REG:     return registers[v.n];
+        case DebugValue::COUNTER: return counter;
+        case DebugValue::MEM:     return uint64_t(v.n) < memory.size() ? memory.load(v.n) : 0;
+        default:                  return v.n;
+    }
+}
+
+// Flags every breakpoint line, and every line whose op writes a watched
+// register, COUNTER or memory cell, in a private copy of the ops.
+void VirtualMachine::compileDebugPoints() {
+    debugOps.clear();
+    if (!program || (breakpoints.empty() && watches.empty())) return;
+    debugOps = program->ops;
+    const int n = program->size();
+    for (const auto& bp : breakpoints)
+        if (bp.first <= n) debugOps[bp.first - 1].flags |= OPF_BREAK;
+
+    auto writes = [](const Op& op, const DebugValue& w) {
+        switch (op.code) {
+            case X_MOV: case X_ADDR: case X_SUBR: case X_LOADMR: case X_STORER:
+            case X_VSUM: case X_VCNT: case X_VMIN: case X_VMAX:
+            case X_MULR: case X_DIVR: case X_MODR: case X_ANDR: case X_ORR: case X_XORR: case X_SHLR: case X_SHRR:
+            case X_SARR: case X_ADDI: case X_MULI: case X_DIVI: case X_MODI: case X_ANDI: case X_ORI: case X_XORI:
+            case X_SHLI: case X_SHRI: case X_SARI: case X_INC: case X_DEC:
+                return w.kind == DebugValue::REG && op.a == w.n;
+            case X_DECR: case X_LOADC: case X_INCC:
+                return w.kind == DebugValue::COUNTER;
+            case X_STOREM: case X_STOREMR: case X_SETM:
+                return w.kind == DebugValue::MEM && op.a == w.n;
+            case X_VADD: case X_VFILL: case X_VCOPY:
+                return w.kind == DebugValue::MEM && w.n >= op.a && int64_t(w.n) < int64_t(op.a) + op.c;
+            default:
+                return false;
+        }
+    };
+    for (int i = 0; i < n; ++i)
+        for (const DebugValue& w : watches)
+            if (writes(debugOps[i], w)) debugOps[i].flags |= OPF_WATCH;
+}
+
+// Whether a breakpoint stops the stepper before the line at pc. Only lines
+// flagged OPF_BREAK get past the first test. countHit is false when
+// searching backwards (rcont), which doesn't count towards `from`.
+bool VirtualMachine::breakHere(bool countHit) {
+    if (debugOps.empty() || pc >= (int)debugOps.size() || !(debugOps[pc].flags & OPF_BREAK)) return false;
+    Breakpoint& bp = breakpoints.at(pc + 1);
+    if (bp.conditional) {
+        int32_t l = debugValue(bp.lhs), r = debugValue(bp.rhs);
+        bool holds = bp.cmp == "==" ? l == r : bp.cmp == "!=" ? l != r
+                   : bp.cmp == "<"  ? l < r  : bp.cmp == "<=" ? l <= r
+                   : bp.cmp == ">"  ? l > r  : l >= r;
+        if (!holds) return false;
+    }
+    if (!countHit) return true;
+    return ++bp.hits >= bp.from;
 }
 
 void VirtualMachine::dumpRegs() const {
@@ -222,12 +646,18 @@ void VirtualMachine::dumpStack() const {
     for (size_t i = 0; i < stack.size(); ++i)
         std::cout << stack[i] << (i+1<stack.size()?", ":"");
     std::cout << "]\n";
+    if (!returns.empty()) {
+        std::cout << "CALLS: [";
+        for (size_t i = 0; i < returns.size(); ++i)
+            std::cout << returns[i] + 1 << (i+1<returns.size()?", ":"");
+        std::cout << "]\n";
+    }
 }
 void VirtualMachine::dumpMem(int start, int len) const {
     if (start < 0) start = 0;
-    int end = std::min<int>(start + len, (int)memory.size());
-    for (int i = start; i < end; ++i) {
-        std::cout << "[" << i << "]=" << memory[i] << ((i+1<end)?"  ":"\n");
+    int64_t end = std::min<int64_t>(int64_t(start) + len, (int64_t)memory.size());
+    for (int64_t i = start; i < end; ++i) {
+        std::cout << "[" << i << "]=" << memory.load(i) << ((i+1<end)?"  ":"\n");
     }
 }
 
@@ -241,459 +671,981 @@ void VirtualMachine::printHelp() const {
     "  stack            Show stack\n"
     "  mem <start> <n>  Show n memory cells starting at start\n"
     "  bp add <n>       Add breakpoint at line n (1-based)\n"
+    "    ... if <a> <op> <b>   only when it holds, e.g. bp add 5 if R0 > 10\n"
+    "    ... hits <k>          only from the k-th hit on\n"
     "  bp del <n>       Remove breakpoint\n"
     "  bp list          List breakpoints\n"
+    "  bp clear         Remove all breakpoints\n"
+    "  watch <what>     Stop when R0-R7, COUNTER or mem <addr> changes\n"
+    "  watch del <what> / watch list / watch clear\n"
     "  trace on|off     Toggle raw instruction trace\n"
     "  explain on|off   Toggle human explanations\n"
     "  disasm           Disassemble loaded bytecode\n"
+    "  snapshot [name]  Save the machine state (copy-on-write)\n"
+    "  restore [name]   Go back to a saved state\n"
+    "  rstep / rs [n]   Undo the last n instructions (default 1)\n"
+    "  rcont / rc       Run backwards to the previous breakpoint or the start\n"
+    "  goto <n>         Go to the point after n instructions, either way\n"
     "  help             Show this help\n"
     "  quit / q         Exit stepper\n";
     }
 
 
-VirtualMachine::VirtualMachine() : memory(256, 0), registers(8, 0) {
-    initializeDispatchTable();
-}                              // initialize 256 memory cells with 0
-
+VirtualMachine::VirtualMachine(std::shared_ptr<const Program> program, uint64_t memoryCells)
+    : memory(memoryCells), memoryCells(memoryCells), registers(VM_REGISTERS, 0), program(std::move(program)) {
+    if (this->program) loadData();  // memory starts zeroed, then gets the data section
+}
 
+VirtualMachine::Snapshot VirtualMachine::snapshot() {
+    Snapshot s;
+    s.program = program;
+    s.memory = memory.snapshot();
+    s.stack = stack.values();
+    s.returns = returns.values();
+    s.registers = registers;
+    s.counter = counter;
+    s.pc = pc;
+    s.flag_eq = flag_eq; s.flag_gt = flag_gt; s.flag_lt = flag_lt;
+    s.executed = executed;
+    return s;
+}
 
-void VirtualMachine::loadBytecode(const std::string& filename) {
-    std::ifstream file(filename, std::ios::binary);
-    if (!file) {
-        std::cerr << "Could not open bytecode file\n";
-        return;
+void VirtualMachine::restore(const Snapshot& s) {
+    if (program != s.program) {
+        program = s.program;
+        blocks.clear();
+        tierLog.clear();
+        jit.reset();
+        compileDebugPoints();
     }
+    memory = s.memory;
+    memory.unpage();  // the snapshot keeps its pages
+    stack.assign(s.stack);
+    returns.assign(s.returns);
+    registers = s.registers;
+    counter = s.counter;
+    pc = s.pc;
+    flag_eq = s.flag_eq; flag_gt = s.flag_gt; flag_lt = s.flag_lt;
+    executed = s.executed;
+}
 
-    Instruction instr;
-    while (file.read(reinterpret_cast<char*>(&instr), sizeof(instr))) {
-        bytecode.push_back(instr);
-    }
+VirtualMachine VirtualMachine::fork() {
+    VirtualMachine child(nullptr, memoryCells);
+    child.setStackDepth(stackDepth);
+    child.restore(snapshot());
+    if (out != stdoutSink.get()) child.out = out;
+    child.quiet = quiet;
+    child.useJit = useJit;
+    child.tiered = tiered;
+    child.tiers = tiers;
+    child.trace = trace;
+    child.explain = explain;
+    child.breakpoints = breakpoints;
+    child.watches = watches;
+    child.compileDebugPoints();
+    child.historyLimit = historyLimit;
+    return child;
 }
 
-void VirtualMachine::runBytecode() {
-    for (pc = 0; pc < bytecode.size(); ++pc) {
-        const Instruction& instr = bytecode[pc];
+void VirtualMachine::setOutput(OutputSink* sink) {
+    if (out) output().flush();
+    out = sink;
+}
 
-        auto it = dispatch.find(instr.opcode);
-        if (it != dispatch.end()) {
-            it->second(instr);
-        } else {
-            std::cerr << "Unknown opcode: 0x" << std::hex << int(instr.opcode) << std::dec << std::endl;
-        }
+OutputSink& VirtualMachine::output() {
+    if (!out) {
+        if (!stdoutSink) stdoutSink = std::make_unique<BufferedSink>(std::cout);
+        out = stdoutSink.get();
     }
+    return *out;
 }
 
+bool VirtualMachine::setMemory(const std::vector<int>& cells) {
+    if (cells.size() > memory.size()) return false;
+    for (size_t i = 0; i < cells.size(); ++i) memory.store(i, cells[i]);
+    return true;
+}
 
+void VirtualMachine::setMemorySize(uint64_t cells) {
+    memoryCells = cells;
+    memory.resize(program ? std::max(cells, program->memoryCells) : cells);
+}
 
-void VirtualMachine::initializeDispatchTable() {
-    dispatch[OP_PUSH] = [this](const Instruction& instr) {
-        stack.push_back(instr.a);
-    };
+void VirtualMachine::setStackDepth(size_t values) {
+    stackDepth = values;
+    stack.setCapacity(values);
+}
 
-    dispatch[OP_MOV] = [this](const Instruction& instr) {
-        if (instr.a < registers.size()) {
-            registers[instr.a] = instr.b;
-        }
-    };
 
-    dispatch[OP_ADDR] = [this](const Instruction& instr) {
-        if (instr.a < registers.size() && instr.b < registers.size() && instr.c < registers.size()) {
-            registers[instr.a] = registers[instr.b] + registers[instr.c];
-        }
-    };
 
-    dispatch[OP_LOADR] = [this](const Instruction& instr) {
-        if (instr.a < registers.size()) {
-            stack.push_back(registers[instr.a]);
-        }
-    };
+bool VirtualMachine::loadBytecode(const std::string& filename, std::string* error) {
+    std::shared_ptr<const Program> p = Program::load(filename, error);
+    if (!p || !stackFits(*p, error)) return false;
+    setProgram(std::move(p));
+    return true;
+}
 
-    dispatch[OP_STORER] = [this](const Instruction& instr) {
-        if (!stack.empty() && instr.a < registers.size()) {
-            registers[instr.a] = stack.back();
-            stack.pop_back();
+bool VirtualMachine::loadSource(std::string_view source, std::string* error, AssemblyCache* cache) {
+    std::shared_ptr<const Program> p;
+    if (cache) {
+        p = cache->get(source, "<source>", error);
+    } else {
+        std::vector<uint8_t> bytes;
+        std::string why;
+        if (!assemble(source, bytes, why)) {
+            if (error) *error = why;
+            else std::cerr << why << "\n";
+            return false;
         }
-    };
+        p = Program::fromMemory(bytes.data(), bytes.size(), "<source>", error);
+    }
+    if (!p || !stackFits(*p, error)) return false;
+    setProgram(std::move(p));
+    return true;
+}
 
-    dispatch[OP_PRINT] = [this](const Instruction&) {
-        if (!stack.empty()) {
-            std::cout << stack.back() << std::endl;
-        }
-    };
+void VirtualMachine::setProgram(std::shared_ptr<const Program> p) {
+    program = std::move(p);
+    blocks.clear();
+    tierLog.clear();
+    jit.reset();
+    if (program) loadData();
+    compileDebugPoints();
+}
 
-    dispatch[OP_PRINTR] = [this](const Instruction& instr) {
-        if (instr.a < registers.size()) {
-            std::cout << "[PRINTR] R" << int(instr.a) << " = " << registers[instr.a] << std::endl;
-        }
-    };
+// Grows memory to what the program declares, then copies its data section
+// in from cell 0. Program::load has already checked the data fits.
+void VirtualMachine::loadData() {
+    if (program->memoryCells > memory.size()) memory.resize(program->memoryCells);
+    for (size_t i = 0; i < program->data.size(); ++i) memory.store(i, program->data[i]);
+}
 
-    dispatch[OP_CMP] = [this](const Instruction& instr) {
-    int a = (instr.a == 0xFF) ? counter : registers[instr.a];
-    int b = (instr.b == 0xFF) ? counter : registers[instr.b];
+// Proven blocks run with no depth tests, so each one's entry depth plus
+// what it pushes has to fit the capacity. That depth is the same on every
+// path in, so the check is made once, before the program runs, rather than
+// at each entry: a block that does not fit now never will, and the program
+// is refused. The reason goes to *error, or to std::cerr when error is null.
+bool VirtualMachine::stackFits(const Program& p, std::string* error) const {
+    if (p.maxStack <= stack.capacity()) return true;
+    for (const Program::Block& b : p.blocks) {
+        if (b.peak <= (int)stack.capacity()) continue;
+        std::string why = "Stack overflow in the block at line " + std::to_string(b.start + 1) + ": it needs "
+                        + std::to_string(b.peak) + " values (capacity " + std::to_string(stack.capacity()) + ")";
+        if (error) *error = why;
+        else std::cerr << why << "\n";
+        break;
+    }
+    return false;
+}
 
-    flag_eq = (a == b);
-    flag_gt = (a > b);
-    flag_lt = (a < b);
+const void* const* VirtualMachine::handlerTable() {
+#if VM_COMPUTED_GOTO
+    static const void* const* const table = VirtualMachine().interpret({}, 0, true);
+    return table;
+#else
+    return nullptr;
+#endif
+}
 
-    std::cout << "[CMP] " << a << " vs " << b
-              << " => EQ: " << flag_eq
-              << ", GT: " << flag_gt
-              << ", LT: " << flag_lt << std::endl;
-    };
 
-    dispatch[OP_JEQ] = [this](const Instruction& instr) {
-    if (flag_eq) pc = instr.a - 1;
-    };
-    dispatch[OP_JNE] = [this](const Instruction& instr) {
-        if (!flag_eq) pc = instr.a - 1;
-    };
-    dispatch[OP_JGT] = [this](const Instruction& instr) {
-        if (flag_gt) pc = instr.a - 1;
+// --- interpreter core ---
+// Runs `code` (ops or fused) from pc until HALT, or until control reaches
+// an op whose flags intersect `stop`: OPF_STEP runs exactly one op,
+// OPF_LEADER runs until the tiered runner has to move to another tier
+// (see enterBlock), OPF_BREAK | OPF_WATCH until the stepper's next debug
+// point (see continueFast), 0 runs the whole program. Stoppable runs also
+// return after runLimit instructions. Handler bodies are written
+// once and expanded either as computed-goto labels or switch cases. The
+// plain instantiation threads through Op::handler with no stop test at
+// all; the stoppable one tests Op::flags before every op. Paged memory gets
+// its own instantiations too, so the flat one indexes memory with no test
+// of which kind it has, and so do profiled and traced runs (`Hooks`, see
+// runInstrumented). All but the plain flat one dispatch through their own
+// label table. With exportLabels set it only hands back the plain label
+// table for decode().
+
+const void* const* VirtualMachine::interpret(const std::vector<Op>& code, uint8_t stop, bool exportLabels) {
+    if (memory.paged())
+        return stop ? interpretCore<true, true, 0>(code, stop, false)
+                    : interpretCore<false, true, 0>(code, 0, false);
+    return stop ? interpretCore<true, false, 0>(code, stop, exportLabels)
+                : interpretCore<false, false, 0>(code, 0, exportLabels);
+}
+
+template <bool Stoppable, bool Paged, int Hooks>
+const void* const* VirtualMachine::interpretCore(const std::vector<Op>& stream, uint8_t stop, bool exportLabels) {
+#if VM_COMPUTED_GOTO
+    static const void* const labels[X_COUNT] = {
+        &&L_X_PUSH, &&L_X_MOV, &&L_X_ADDR, &&L_X_LOADR, &&L_X_STORER,
+        &&L_X_PRINT, &&L_X_PRINTR,
+        &&L_X_CMP_RR, &&L_X_CMP_CR, &&L_X_CMP_RC, &&L_X_CMP_CC,
+        &&L_X_JEQ, &&L_X_JNE, &&L_X_JGT, &&L_X_JLT, &&L_X_JMP,
+        &&L_X_LOADM, &&L_X_STOREM, &&L_X_LOADMR, &&L_X_STOREMR,
+        &&L_X_DECR, &&L_X_CPRINT, &&L_X_HALT,
+        &&L_X_ADD, &&L_X_SUB, &&L_X_MUL, &&L_X_DUP, &&L_X_JZ, &&L_X_JNZ,
+        &&L_X_LOADC, &&L_X_CJNZ, &&L_X_SETM, &&L_X_MEMDUMP,
+        &&L_X_SUBR,
+        &&L_X_VADD, &&L_X_VFILL, &&L_X_VCOPY, &&L_X_VSUM, &&L_X_VCNT, &&L_X_VMIN, &&L_X_VMAX,
+        &&L_X_MULR, &&L_X_DIVR, &&L_X_MODR, &&L_X_ANDR, &&L_X_ORR, &&L_X_XORR, &&L_X_SHLR, &&L_X_SHRR, &&L_X_SARR,
+        &&L_X_ADDI, &&L_X_MULI, &&L_X_DIVI, &&L_X_MODI, &&L_X_ANDI, &&L_X_ORI, &&L_X_XORI,
+        &&L_X_SHLI, &&L_X_SHRI, &&L_X_SARI,
+        &&L_X_INC, &&L_X_DEC, &&L_X_INCC,
+        &&L_X_CMP_RI, &&L_X_CMP_CI,
+        &&L_X_CALL, &&L_X_RET,
+        &&L_X_CMPJ_RR_EQ, &&L_X_CMPJ_RR_NE, &&L_X_CMPJ_RR_GT, &&L_X_CMPJ_RR_LT,
+        &&L_X_CMPJ_CR_EQ, &&L_X_CMPJ_CR_NE, &&L_X_CMPJ_CR_GT, &&L_X_CMPJ_CR_LT,
+        &&L_X_DCMPJ_EQ, &&L_X_DCMPJ_NE, &&L_X_DCMPJ_GT, &&L_X_DCMPJ_LT,
+        &&L_X_CMPJ_RI_EQ, &&L_X_CMPJ_RI_NE, &&L_X_CMPJ_RI_GT, &&L_X_CMPJ_RI_LT,
+        &&L_X_CMPJ_CI_EQ, &&L_X_CMPJ_CI_NE, &&L_X_CMPJ_CI_GT, &&L_X_CMPJ_CI_LT,
+        &&L_X_DCMPJI_EQ, &&L_X_DCMPJI_NE, &&L_X_DCMPJI_GT, &&L_X_DCMPJI_LT,
+        &&L_X_MOV2,
+        &&L_X_PUSH_U, &&L_X_LOADR_U, &&L_X_STORER_U, &&L_X_PRINT_U, &&L_X_LOADM_U, &&L_X_STOREM_U,
+        &&L_X_ADD_U, &&L_X_SUB_U, &&L_X_MUL_U, &&L_X_DUP_U, &&L_X_JZ_U, &&L_X_JNZ_U,
     };
-    dispatch[OP_JLT] = [this](const Instruction& instr) {
-        if (flag_lt) pc = instr.a - 1;
+    if (exportLabels) return labels;
+#define CASE(x)   L_##x:
+#define DISPATCH() \
+    do { ++count; if (Hooks) hook(ip); goto *(Stoppable || Paged || Hooks ? labels[ip->code] : ip->handler); } while (0)
+#else
+    if (exportLabels) return nullptr;
+#define CASE(x)   case x:
+#define DISPATCH() do { ++count; goto dispatch; } while (0)
+#endif
+#define CONTINUE() \
+    do { if (Stoppable && (((ip->flags & stop) && stopAt(ip)) || count >= limit)) goto out; DISPATCH(); } while (0)
+#define NEXT()     do { ++ip; CONTINUE(); } while (0)
+#define JUMP(cond) \
+    do { const bool t_ = (cond); if ((Hooks & HOOK_PROFILE) && t_) ++taken[ip - code]; ip = t_ ? code + ip->a : ip + 1; CONTINUE(); } while (0)
+// the stack's top lives in tos; sp points at its slot (see OperandStack)
+#define SPUSH(v)   do { *sp++ = tos; tos = (v); } while (0)
+#define SDROP()    do { tos = *--sp; } while (0)
+// fused CMP+Jcc: `skip` plain ops are covered when the branch falls through;
+// ra names the left operand for the echo, as compare() takes it
+#define CMPJ(lhs, rhs, ra, flag, skip) \
+    do { compare(lhs, rhs, ra, ip->b); count += (skip) - 1; ip = (flag) ? code + ip->c : ip + (skip); CONTINUE(); } while (0)
+
+    const Op* code = stream.data();
+    const Op* ip = code + pc;
+    const uint8_t tier = (code == program->fused.data()) ? 1 : 0;
+    int* regs = registers.data();
+    int* mem = memory.flat();  // null when paged
+    uint64_t count = 0;
+    const uint64_t limit = runLimit;
+
+    // the operand stack, held in locals until the run returns; the tested
+    // stack ops check sp against sbase (empty) and sfull, the _U forms
+    // nothing (see Program::proveStack)
+    int* const sbase = stack.base();
+    int* const sfull = sbase + stack.capacity();
+    int* sp = sbase + stack.size();
+    int tos = *sp;
+    auto depth = [&]() { return uint32_t(sp - sbase); };
+    // the return stack likewise, though nothing of it is cached: rsp
+    // points at the innermost return address, rbase when there is none
+    int* const rbase = returns.base();
+    int* const rfull = rbase + returns.capacity();
+    int* rsp = rbase + returns.size();
+
+    OutputSink& o = output();
+    const bool echo = !quiet;  // CMP and memory ops report what they did
+    const bool text = program->text;  // text-mode CMP and CPRINT formats
+
+    // flat memory is indexed directly, paged memory through its page table;
+    // either way the address was range-checked at load
+    auto load = [&](int a) { return Paged ? memory.loadPaged(a) : mem[a]; };
+    auto store = [&](int a, int v) { if (Paged) memory.storePaged(a, v); else mem[a] = v; };
+
+    // a block op's cells from `from`, for the echo
+    auto range = [&](int from) { o << "memory[" << from << ".." << (long long)from + ip->c - 1 << "]"; };
+    (void)range;
+
+    // ra and rb name the operands for the text-mode echo: a register, or
+    // -1 for COUNTER
+    auto compare = [&](int a, int b, int ra, int rb) {
+        flag_eq = (a == b);
+        flag_gt = (a > b);
+        flag_lt = (a < b);
+        if (!echo) return;
+        auto name = [&](int r, int v) {
+            if (r < 0) o << "COUNTER(" << v << ")";
+            else o << "R" << r << "(" << v << ")";
+        };
+        o << "[CMP] ";
+        if (text) { name(ra, a); o << " vs "; name(rb, b); }
+        else o << a << " vs " << b;
+        o << " => EQ: " << flag_eq
+              << ", GT: " << flag_gt
+              << ", LT: " << flag_lt << '\n';
     };
 
-
-    dispatch[OP_LOADM] = [this](const Instruction& instr) {
-    if (isValidAddr(instr.a)) {
-        stack.push_back(memory[instr.a]);
-        std::cout << "[LOADM] memory[" << instr.a << "] => " << memory[instr.a] << std::endl;
-        }
+    // single-stepping stops at every op; a tiered run only when the block
+    // just entered belongs to another tier
+    auto stopAt = [&](const Op* at) {
+        return !(stop & OPF_LEADER) || enterBlock(int(at - code), tier);
     };
-
-    dispatch[OP_STOREM] = [this](const Instruction& instr) {
-        if (!stack.empty() && isValidAddr(instr.a)) {
-            int val = stack.back(); stack.pop_back();
-            memory[instr.a] = val;
-            std::cout << "[STOREM] memory[" << instr.a << "] = " << val << std::endl;
-        }
+    (void)stopAt; (void)tier; (void)limit;
+
+    // profiled runs count every op and jump taken, and time about one op
+    // in Profile::SAMPLE_EVERY, from its dispatch to the next one; the gap
+    // between samples is random so a loop can't always hide the same op
+    constexpr bool Profiled = Hooks & HOOK_PROFILE;
+    uint64_t* hits = Profiled ? profile->hits.data() : nullptr;
+    uint64_t* taken = Profiled ? profile->taken.data() : nullptr;
+    uint64_t rng = 0x9E3779B97F4A7C15ull;
+    auto nextGap = [&]() {
+        rng = rng * 6364136223846793005ull + 1442695040888963407ull;
+        return Profile::SAMPLE_EVERY / 2 + int(rng >> 58) % Profile::SAMPLE_EVERY;
     };
-
-    dispatch[OP_LOADMR] = [this](const Instruction& instr) {
-    if (instr.a < registers.size() && isValidAddr(instr.b)) {
-        registers[instr.a] = memory[instr.b];
-        std::cout << "[LOADMR] R" << instr.a << " = memory[" << instr.b << "] = " << memory[instr.b] << std::endl;
+    int sampleIn = Profile::SAMPLE_EVERY;
+    ptrdiff_t sampled = 0;
+    std::chrono::steady_clock::time_point sampleStart;
+    auto profileOp = [&](const Op* at) {
+        ++hits[at - code];
+        if (--sampleIn > 1) return;
+        auto now = std::chrono::steady_clock::now();
+        if (sampleIn == 1) {
+            sampled = at - code;
+            sampleStart = now;
+        } else {
+            profile->sampleNanos[sampled] += std::chrono::duration_cast<std::chrono::nanoseconds>(now - sampleStart).count();
+            ++profile->samples[sampled];
+            sampleIn = nextGap();
         }
     };
-
-    dispatch[OP_STOREMR] = [this](const Instruction& instr) {
-        if (instr.b < registers.size() && isValidAddr(instr.a)) {
-            memory[instr.a] = registers[instr.b];
-            std::cout << "[STOREMR] memory[" << instr.a << "] = " << registers[instr.b] << std::endl;
+    (void)profileOp; (void)taken; (void)nextGap;
+
+    // traced runs open a record as each op is dispatched (what it is, stack
+    // depth before) and finish it (what it changed) when the next one is
+    TraceRecord* rec = nullptr;
+    const Instruction* lines = program->bytecode.data();
+    auto finishTrace = [&](const Op* next) {
+        TraceRecord& r = *rec;
+        const Op& op = code[r.pc];
+        switch (op.code) {
+            case X_MOV: case X_ADDR: case X_SUBR: case X_LOADMR:
+            case X_VSUM: case X_VCNT: case X_VMIN: case X_VMAX:
+            case X_MULR: case X_DIVR: case X_MODR: case X_ANDR: case X_ORR: case X_XORR: case X_SHLR: case X_SHRR:
+            case X_SARR: case X_ADDI: case X_MULI: case X_DIVI: case X_MODI: case X_ANDI: case X_ORI: case X_XORI:
+            case X_SHLI: case X_SHRI: case X_SARI: case X_INC: case X_DEC:
+                r.change = TRACE_REG; r.index = op.a; r.value = regs[op.a]; break;
+            case X_VADD: case X_VFILL: case X_VCOPY:
+                r.change = TRACE_BLOCK; r.index = op.a; r.value = op.c; break;
+            case X_DECR: case X_LOADC: case X_INCC:
+                r.change = TRACE_COUNTER; r.value = counter; break;
+            case X_STOREMR: case X_SETM:
+                r.change = TRACE_MEM; r.index = op.a; r.value = load(op.a); break;
+            case X_PUSH: case X_LOADR: case X_LOADM: case X_DUP:
+                if (depth() > r.depth) { r.change = TRACE_PUSH; r.value = tos; }
+                break;
+            case X_ADD: case X_SUB: case X_MUL:
+                if (r.depth >= 2) { r.change = TRACE_PUSH; r.value = tos; }
+                break;
+            case X_STORER:
+                if (depth() < r.depth) { r.change = TRACE_POP_REG; r.index = op.a; r.value = regs[op.a]; }
+                break;
+            case X_STOREM:
+                if (depth() < r.depth) { r.change = TRACE_POP_MEM; r.index = op.a; r.value = load(op.a); }
+                break;
+            case X_CMP_RR: case X_CMP_CR: case X_CMP_RC: case X_CMP_CC: case X_CMP_RI: case X_CMP_CI:
+                r.change = TRACE_FLAGS; break;
+            case X_JEQ: case X_JNE: case X_JGT: case X_JLT:
+                r.change = TRACE_JUMP;
+                r.value = int32_t(next - code);
+                r.index = op.code == X_JEQ ? flag_eq : op.code == X_JNE ? !flag_eq
+                        : op.code == X_JGT ? flag_gt : flag_lt;
+                break;
+            case X_JZ: case X_JNZ: case X_CJNZ:
+                r.change = TRACE_JUMP;
+                r.value = int32_t(next - code);
+                r.index = next != code + r.pc + 1 || op.a == r.pc + 1;
+                break;
+            case X_CALL: case X_RET:
+                r.change = TRACE_JUMP;
+                r.value = int32_t(next - code);
+                r.index = 1;
+                break;
+            default: break;
         }
+        r.flags = uint8_t(flag_eq | flag_gt << 1 | flag_lt << 2);
+        r.depth = depth();
+        tracer->publish();
+        rec = nullptr;
     };
-
-    dispatch[OP_DECR] = [this](const Instruction&) {
-        counter--;
-    };
-
-    dispatch[OP_CPRINT] = [this](const Instruction&) {
-        std::cout << "[CPRINT] counter = " << counter << std::endl;
+    auto traceOp = [&](const Op* at) {
+        if (rec) finishTrace(at);
+        if (at->code == X_HALT) return;
+        const int line = int(at - code);
+        const Instruction& ins = lines[line];
+        rec = &tracer->claim();
+        *rec = TraceRecord{};
+        rec->pc = line;
+        rec->opcode = ins.opcode;
+        rec->a = ins.a; rec->b = ins.b; rec->c = ins.c;
+        rec->depth = depth();
     };
+    (void)lines; (void)traceOp;
 
-
-    dispatch[OP_CEASE] = [this](const Instruction&) {
-        pc = bytecode.size();  // force loop exit in runBytecode
+    auto hook = [&](const Op* at) {
+        if (Hooks & HOOK_PROFILE) profileOp(at);
+        if (Hooks & HOOK_TRACE) traceOp(at);
     };
-}
-
-
-
-bool VirtualMachine::isValidAddr(int addr) const {
-    return addr >= 0 && addr < memory.size();
-}
-
-void VirtualMachine::loadProgram(const std::string& filename) {
-    std::ifstream file(filename);
-    std::string line;
-    while (std::getline(file, line)) {
-        instructions.push_back(line);
-    }
-}
-
-void VirtualMachine::run() {
-    for (pc = 0; pc < instructions.size(); ++pc) {
-        execute(instructions[pc]);
+    (void)hook;
+
+#if VM_COMPUTED_GOTO
+    DISPATCH();
+#else
+    ++count;
+dispatch:
+    if (Hooks) hook(ip);
+    switch (ip->code) {
+#endif
+
+    CASE(X_PUSH)
+        if (sp == sfull) goto overflow;
+        SPUSH(ip->a);
+        NEXT();
+    CASE(X_MOV)     regs[ip->a] = ip->b; NEXT();
+    CASE(X_ADDR)    regs[ip->a] = wrapAdd(regs[ip->b], regs[ip->c]); NEXT();
+    CASE(X_SUBR)    regs[ip->a] = wrapSub(regs[ip->b], regs[ip->c]); NEXT();
+    CASE(X_LOADR)
+        if (sp == sfull) goto overflow;
+        SPUSH(regs[ip->a]);
+        NEXT();
+    CASE(X_STORER)
+        if (sp != sbase) { regs[ip->a] = tos; SDROP(); }
+        NEXT();
+    CASE(X_PRINT)
+        if (sp != sbase) o << tos << '\n';
+        NEXT();
+    CASE(X_PRINTR)
+        o << "[PRINTR] R" << ip->a << " = " << regs[ip->a] << '\n';
+        NEXT();
+
+    CASE(X_CMP_RR)  compare(regs[ip->a], regs[ip->b], ip->a, ip->b); NEXT();
+    CASE(X_CMP_CR)  compare(counter, regs[ip->b], -1, ip->b); NEXT();
+    CASE(X_CMP_RC)  compare(regs[ip->a], counter, ip->a, -1); NEXT();
+    CASE(X_CMP_CC)  compare(counter, counter, -1, -1); NEXT();
+
+    CASE(X_JEQ)     JUMP(flag_eq);
+    CASE(X_JNE)     JUMP(!flag_eq);
+    CASE(X_JGT)     JUMP(flag_gt);
+    CASE(X_JLT)     JUMP(flag_lt);
+    CASE(X_JMP)     JUMP(true);
+
+    CASE(X_LOADM)
+        if (sp == sfull) goto overflow;
+        SPUSH(load(ip->a));
+        if (echo) o << "[LOADM] memory[" << ip->a << "] => " << tos << '\n';
+        NEXT();
+    CASE(X_STOREM)
+        if (sp != sbase) {
+            int val = tos; SDROP();
+            store(ip->a, val);
+            if (echo) o << "[STOREM] memory[" << ip->a << "] = " << val << '\n';
+        }
+        NEXT();
+    CASE(X_LOADMR)
+        regs[ip->a] = load(ip->b);
+        if (echo) o << "[LOADMR] R" << ip->a << " = memory[" << ip->b << "] = " << regs[ip->a] << '\n';
+        NEXT();
+    CASE(X_STOREMR)
+        store(ip->a, regs[ip->b]);
+        if (echo) o << "[STOREMR] memory[" << ip->a << "] = " << regs[ip->b] << '\n';
+        NEXT();
+
+    CASE(X_DECR)    counter = wrapAdd(counter, -1); NEXT();
+    CASE(X_CPRINT)
+        if (!text) o << "[CPRINT] counter = ";
+        o << counter << '\n';
+        NEXT();
+
+    CASE(X_HALT)
+        --count;  // HALT is not a program instruction
+        goto out;
+
+    // like STORER, these do nothing to a stack too short for them (a pop
+    // from an empty stack is a jump not taken)
+    CASE(X_ADD)
+        if (sp - sbase >= 2) { tos = wrapAdd(sp[-1], tos); --sp; }
+        NEXT();
+    CASE(X_SUB)
+        if (sp - sbase >= 2) { tos = wrapSub(sp[-1], tos); --sp; }
+        NEXT();
+    CASE(X_MUL)
+        if (sp - sbase >= 2) { tos = wrapMul(sp[-1], tos); --sp; }
+        NEXT();
+    CASE(X_DUP)
+        if (sp != sbase) {
+            if (sp == sfull) goto overflow;
+            SPUSH(tos);
+        }
+        NEXT();
+    CASE(X_JZ) {
+        bool t = false;
+        if (sp != sbase) { t = tos == 0; SDROP(); }
+        JUMP(t);
     }
-}
-
-void VirtualMachine::execute(const std::string& instrLine) {
-    std::istringstream iss(instrLine);
-    std::string instr;
-    int operand;
-    iss >> instr;
-
-     if (!instr.empty() && instr.back() == ':') {
-        // This is a label definition, skip execution
-        return;
+    CASE(X_JNZ) {
+        bool t = false;
+        if (sp != sbase) { t = tos != 0; SDROP(); }
+        JUMP(t);
     }
-
-    // ─── Control Flow ───
-    if (instr == "HOP") { // move lines 
-        iss >> operand;
-        pc = operand - 1;
+    CASE(X_LOADC)   counter = ip->a; NEXT();
+    CASE(X_CJNZ)    JUMP(counter != 0);
+    CASE(X_SETM)
+        store(ip->a, ip->b);
+        if (echo) o << "[SETM] memory[" << ip->a << "] = " << ip->b << '\n';
+        NEXT();
+    CASE(X_MEMDUMP)
+        memory.forEachNonZero([&](uint64_t i, int32_t v) { o << "[" << (long long)i << "] = " << v << '\n'; });
+        NEXT();
+
+    // block ops: one dispatch, then the host's vector kernels over the
+    // whole range (see Vector.h)
+    CASE(X_VADD)
+        blockAdd(memory, ip->a, ip->b, ip->c);
+        if (echo) { o << "[VADD] "; range(ip->a); o << " += "; range(ip->b); o << '\n'; }
+        NEXT();
+    CASE(X_VFILL)
+        blockFill(memory, ip->a, ip->c, regs[ip->b]);
+        if (echo) { o << "[VFILL] "; range(ip->a); o << " = " << regs[ip->b] << '\n'; }
+        NEXT();
+    CASE(X_VCOPY)
+        blockCopy(memory, ip->a, ip->b, ip->c);
+        if (echo) { o << "[VCOPY] "; range(ip->a); o << " = "; range(ip->b); o << '\n'; }
+        NEXT();
+#define VREDUCE(name, what, value) \
+    do { \
+        regs[ip->a] = (value); \
+        if (echo) { o << "[" name "] R" << ip->a << " = " what " "; range(ip->b); o << " = " << regs[ip->a] << '\n'; } \
+        NEXT(); \
+    } while (0)
+    CASE(X_VSUM)    VREDUCE("VSUM", "sum of", blockSum(memory, ip->b, ip->c));
+    CASE(X_VCNT)    VREDUCE("VCNT", "matches in", blockCount(memory, ip->b, ip->c, regs[ip->a]));
+    CASE(X_VMIN)    VREDUCE("VMIN", "least of", blockMin(memory, ip->b, ip->c));
+    CASE(X_VMAX)    VREDUCE("VMAX", "greatest of", blockMax(memory, ip->b, ip->c));
+#undef VREDUCE
+
+    // ALU: shift counts were reduced mod 32 at load, DIVI/MODI by 0
+    // refused there; DIVR/MODR test their divisor here
+    CASE(X_MULR)    regs[ip->a] = wrapMul(regs[ip->b], regs[ip->c]); NEXT();
+    CASE(X_DIVR)
+        if (!regs[ip->c]) goto divideByZero;
+        regs[ip->a] = wrapDiv(regs[ip->b], regs[ip->c]);
+        NEXT();
+    CASE(X_MODR)
+        if (!regs[ip->c]) goto divideByZero;
+        regs[ip->a] = wrapMod(regs[ip->b], regs[ip->c]);
+        NEXT();
+    CASE(X_ANDR)    regs[ip->a] = regs[ip->b] & regs[ip->c]; NEXT();
+    CASE(X_ORR)     regs[ip->a] = regs[ip->b] | regs[ip->c]; NEXT();
+    CASE(X_XORR)    regs[ip->a] = regs[ip->b] ^ regs[ip->c]; NEXT();
+    CASE(X_SHLR)    regs[ip->a] = int32_t(uint32_t(regs[ip->b]) << (regs[ip->c] & 31)); NEXT();
+    CASE(X_SHRR)    regs[ip->a] = int32_t(uint32_t(regs[ip->b]) >> (regs[ip->c] & 31)); NEXT();
+    CASE(X_SARR)    regs[ip->a] = regs[ip->b] >> (regs[ip->c] & 31); NEXT();
+    CASE(X_ADDI)    regs[ip->a] = wrapAdd(regs[ip->b], ip->c); NEXT();
+    CASE(X_MULI)    regs[ip->a] = wrapMul(regs[ip->b], ip->c); NEXT();
+    CASE(X_DIVI)    regs[ip->a] = wrapDiv(regs[ip->b], ip->c); NEXT();
+    CASE(X_MODI)    regs[ip->a] = wrapMod(regs[ip->b], ip->c); NEXT();
+    CASE(X_ANDI)    regs[ip->a] = regs[ip->b] & ip->c; NEXT();
+    CASE(X_ORI)     regs[ip->a] = regs[ip->b] | ip->c; NEXT();
+    CASE(X_XORI)    regs[ip->a] = regs[ip->b] ^ ip->c; NEXT();
+    CASE(X_SHLI)    regs[ip->a] = int32_t(uint32_t(regs[ip->b]) << ip->c); NEXT();
+    CASE(X_SHRI)    regs[ip->a] = int32_t(uint32_t(regs[ip->b]) >> ip->c); NEXT();
+    CASE(X_SARI)    regs[ip->a] = regs[ip->b] >> ip->c; NEXT();
+    CASE(X_INC)     regs[ip->a] = wrapAdd(regs[ip->a], 1); NEXT();
+    CASE(X_DEC)     regs[ip->a] = wrapAdd(regs[ip->a], -1); NEXT();
+    CASE(X_INCC)    counter = wrapAdd(counter, 1); NEXT();
+    CASE(X_CMP_RI)  compare(regs[ip->a], ip->b, ip->a, -1); NEXT();
+    CASE(X_CMP_CI)  compare(counter, ip->b, -1, -1); NEXT();
+    CASE(X_CALL)
+        if (rsp == rfull) goto callOverflow;
+        *++rsp = int(ip - code) + 1;
+        JUMP(true);
+    CASE(X_RET)
+        if (rsp == rbase) goto badReturn;
+        ip = code + *rsp--;
+        CONTINUE();
+
+    CASE(X_CMPJ_RR_EQ) CMPJ(regs[ip->a], regs[ip->b], ip->a, flag_eq, 2);
+    CASE(X_CMPJ_RR_NE) CMPJ(regs[ip->a], regs[ip->b], ip->a, !flag_eq, 2);
+    CASE(X_CMPJ_RR_GT) CMPJ(regs[ip->a], regs[ip->b], ip->a, flag_gt, 2);
+    CASE(X_CMPJ_RR_LT) CMPJ(regs[ip->a], regs[ip->b], ip->a, flag_lt, 2);
+    CASE(X_CMPJ_CR_EQ) CMPJ(counter, regs[ip->b], -1, flag_eq, 2);
+    CASE(X_CMPJ_CR_NE) CMPJ(counter, regs[ip->b], -1, !flag_eq, 2);
+    CASE(X_CMPJ_CR_GT) CMPJ(counter, regs[ip->b], -1, flag_gt, 2);
+    CASE(X_CMPJ_CR_LT) CMPJ(counter, regs[ip->b], -1, flag_lt, 2);
+    CASE(X_DCMPJ_EQ)   counter = wrapAdd(counter, -1); CMPJ(counter, regs[ip->b], -1, flag_eq, 3);
+    CASE(X_DCMPJ_NE)   counter = wrapAdd(counter, -1); CMPJ(counter, regs[ip->b], -1, !flag_eq, 3);
+    CASE(X_DCMPJ_GT)   counter = wrapAdd(counter, -1); CMPJ(counter, regs[ip->b], -1, flag_gt, 3);
+    CASE(X_DCMPJ_LT)   counter = wrapAdd(counter, -1); CMPJ(counter, regs[ip->b], -1, flag_lt, 3);
+    CASE(X_CMPJ_RI_EQ) CMPJ(regs[ip->a], ip->b, ip->a, flag_eq, 2);
+    CASE(X_CMPJ_RI_NE) CMPJ(regs[ip->a], ip->b, ip->a, !flag_eq, 2);
+    CASE(X_CMPJ_RI_GT) CMPJ(regs[ip->a], ip->b, ip->a, flag_gt, 2);
+    CASE(X_CMPJ_RI_LT) CMPJ(regs[ip->a], ip->b, ip->a, flag_lt, 2);
+    CASE(X_CMPJ_CI_EQ) CMPJ(counter, ip->b, -1, flag_eq, 2);
+    CASE(X_CMPJ_CI_NE) CMPJ(counter, ip->b, -1, !flag_eq, 2);
+    CASE(X_CMPJ_CI_GT) CMPJ(counter, ip->b, -1, flag_gt, 2);
+    CASE(X_CMPJ_CI_LT) CMPJ(counter, ip->b, -1, flag_lt, 2);
+    CASE(X_DCMPJI_EQ)  counter = wrapAdd(counter, -1); CMPJ(counter, ip->b, -1, flag_eq, 3);
+    CASE(X_DCMPJI_NE)  counter = wrapAdd(counter, -1); CMPJ(counter, ip->b, -1, !flag_eq, 3);
+    CASE(X_DCMPJI_GT)  counter = wrapAdd(counter, -1); CMPJ(counter, ip->b, -1, flag_gt, 3);
+    CASE(X_DCMPJI_LT)  counter = wrapAdd(counter, -1); CMPJ(counter, ip->b, -1, flag_lt, 3);
+    CASE(X_MOV2)
+        regs[ip->a] = ip->b;
+        regs[ip->c] = ip->d;
+        ++count;
+        ip += 2;
+        CONTINUE();
+
+    CASE(X_PUSH_U)   SPUSH(ip->a); NEXT();
+    CASE(X_LOADR_U)  SPUSH(regs[ip->a]); NEXT();
+    CASE(X_STORER_U) regs[ip->a] = tos; SDROP(); NEXT();
+    CASE(X_PRINT_U)  o << tos << '\n'; NEXT();
+    CASE(X_LOADM_U)
+        SPUSH(load(ip->a));
+        if (echo) o << "[LOADM] memory[" << ip->a << "] => " << tos << '\n';
+        NEXT();
+    CASE(X_STOREM_U)
+        store(ip->a, tos);
+        if (echo) o << "[STOREM] memory[" << ip->a << "] = " << tos << '\n';
+        SDROP();
+        NEXT();
+    CASE(X_ADD_U)    tos = wrapAdd(sp[-1], tos); --sp; NEXT();
+    CASE(X_SUB_U)    tos = wrapSub(sp[-1], tos); --sp; NEXT();
+    CASE(X_MUL_U)    tos = wrapMul(sp[-1], tos); --sp; NEXT();
+    CASE(X_DUP_U)    SPUSH(tos); NEXT();
+    CASE(X_JZ_U) {
+        const bool t = tos == 0;
+        SDROP();
+        JUMP(t);
     }
-    else if (instr == "CEASE") {
-        pc = instructions.size(); // ends loop/program
+    CASE(X_JNZ_U) {
+        const bool t = tos != 0;
+        SDROP();
+        JUMP(t);
     }
 
-    // ─── Stack-Based ───
-    else if (instr == "PUSH") { // psuh value onto stack
-        iss >> operand;
-        stack.push_back(operand);
-    }
-    else if (instr == "ADD") { // add two values on stack
-        int b = stack.back(); stack.pop_back();
-        int a = stack.back(); stack.pop_back();
-        stack.push_back(a + b);
-    }
-    else if (instr == "SUB") { // subtract tow values on stack
-        int b = stack.back(); stack.pop_back();
-        int a = stack.back(); stack.pop_back();
-        stack.push_back(a - b);
+#if !VM_COMPUTED_GOTO
+    default: goto out;
     }
-    else if (instr == "MUL") { // multiply two values on stack
-        int b = stack.back(); stack.pop_back();
-        int a = stack.back(); stack.pop_back();
-        stack.push_back(a * b);
-    }
-    else if (instr == "DUP") { // duplicate a value on stack
-        int top = stack.back();
-        stack.push_back(top);
-    }
-    else if (instr == "PRINT") { // print a value on the stack
-        std::cout << stack.back() << std::endl;
+#endif
+
+overflow:
+    // a push onto a full stack ends the program there, and so do the
+    // faults below; each is reported after the output before it
+    o.flush();
+    std::cerr << "Stack overflow at line " << (ip - code) + 1 << " (capacity " << stack.capacity() << ")\n";
+    goto fault;
+
+callOverflow:
+    // a CALL with the return stack full (runaway recursion, usually)
+    o.flush();
+    std::cerr << "Call stack overflow at line " << (ip - code) + 1 << " (depth " << returns.capacity() << ")\n";
+    goto fault;
+
+badReturn:
+    o.flush();
+    std::cerr << "RET with no CALL at line " << (ip - code) + 1 << "\n";
+    goto fault;
+
+divideByZero:
+    // a DIVR or MODR by a register holding 0
+    o.flush();
+    std::cerr << "Division by zero at line " << (ip - code) + 1 << "\n";
+
+fault:
+    faulted = true;
+    --count;
+    ip = code + (stream.size() - 1);  // HALT
+
+out:
+    if ((Hooks & HOOK_TRACE) && rec) finishTrace(ip);
+    *sp = tos;
+    stack.setSize(sp - sbase);
+    returns.setSize(rsp - rbase);
+    pc = int(ip - code);
+    executed += count;
+    return nullptr;
+#undef CMPJ
+#undef SDROP
+#undef SPUSH
+#undef JUMP
+#undef NEXT
+#undef CONTINUE
+#undef DISPATCH
+#undef CASE
+}
+
+void VirtualMachine::runBytecode() {
+    executed = 0;
+    faulted = false;
+    // a run starts at op 0 with both stacks empty, as Program::proveStack
+    // assumed when it dropped the checks from the _U ops
+    stack.clear();
+    returns.clear();
+    if (!program) return;
+    if (!stackFits(*program, nullptr)) {  // the capacity was set after it loaded
+        faulted = true;
+        return;
     }
-    else if (instr == "PKPRINT") { /// peekprint: print a value wihtout affecting stack
-        std::cout << stack.back() << std::endl;
+    memory.unpage();  // a snapshot since the last run paged it
+    if (profiling || tracer) {
+        runInstrumented();
+        return;
     }
-    else if (instr == "HNZ") { // if top of stack is not zero, hop to label
-        int target;
-        iss >> target;
-        int value = stack.back(); stack.pop_back();
-        if (value != 0) pc = target - 1;
+    if (useJit && Jit::supported()) {
+        runJit();
+        return;
     }
-    else if (instr == "HZ") { // if top of stack is zero, hop to label
-        int target;
-        iss >> target;
-        int value = stack.back(); stack.pop_back();
-        if (value == 0) pc = target - 1;
+    if (tiered) {
+        runTiered();
+        return;
     }
+    pc = 0;
+    interpret(program->fused, 0);
+    output().flush();
+}
 
-    // ─── Counter-Based ───
-    else if (instr == "LOAD") { // load a value into counter
-        iss >> counter;
-    }
-    else if (instr == "DECR") { // decrement counter
-        counter--;
-    }
-    else if (instr == "CPRINT") { // print counter value
-        std::cout << counter << std::endl;
+// Runs the unfused ops, so every count and trace record maps to one line,
+// through the profiled and/or traced instantiations.
+void VirtualMachine::runInstrumented() {
+    pc = 0;
+    if (!profiling) {
+        if (memory.paged()) interpretCore<false, true, HOOK_TRACE>(program->ops, 0, false);
+        else interpretCore<false, false, HOOK_TRACE>(program->ops, 0, false);
+        output().flush();
+        return;
     }
-    else if (instr == "CHNZ") { // if counter is not zero, hop to label
-        int target;
-        iss >> target;
-        if (counter != 0) pc = target - 1;
+#if VM_PROFILE
+    if (!profile) profile = std::make_unique<Profile>();
+    profile->reset(program->ops.size());
+
+    // the clock's own cost, taken off every sample in the report
+    auto c0 = std::chrono::steady_clock::now();
+    for (int i = 0; i < 1000; ++i) (void)std::chrono::steady_clock::now();
+    profile->clockNanos = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - c0).count() / 1001;
+
+    auto t0 = std::chrono::steady_clock::now();
+    if (tracer) {
+        if (memory.paged()) interpretCore<false, true, HOOK_PROFILE | HOOK_TRACE>(program->ops, 0, false);
+        else interpretCore<false, false, HOOK_PROFILE | HOOK_TRACE>(program->ops, 0, false);
+    } else {
+        if (memory.paged()) interpretCore<false, true, HOOK_PROFILE>(program->ops, 0, false);
+        else interpretCore<false, false, HOOK_PROFILE>(program->ops, 0, false);
     }
-
-    else if (instr == "STOREM") {
-    int addr;
-    iss >> addr;
-    if (isValidAddr(addr)) {
-    int value = stack.back(); stack.pop_back();
-    memory[addr] = value;
-    std::cout << "[STOREM] memory[" << addr << "] = " << value << std::endl;
+    profile->seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+    profile->instructions = executed;
+#else
+    std::cerr << "profiling is not built in (VM_NO_PROFILE)\n";
+    if (tracer) {
+        if (memory.paged()) interpretCore<false, true, HOOK_TRACE>(program->ops, 0, false);
+        else interpretCore<false, false, HOOK_TRACE>(program->ops, 0, false);
     } else {
-    std::cerr << "Invalid memory address in STOREM: " << addr << std::endl;
-    std::exit(1);
-        }
+        interpret(program->fused, 0);
     }
+#endif
+    output().flush();
+}
 
-    else if (instr == "LOADM") {
-    int addr;
-    iss >> addr;
-    if (isValidAddr(addr)) {
-    stack.push_back(memory[addr]);
-    std::cout << "[LOADM] memory[" << addr << "] => " << memory[addr] << std::endl;
-        }
+// Enters native code at pc with the machine state copied into `ctx`, and
+// copies it back out when native code returns. Returns the op index to
+// resume at.
+int VirtualMachine::runNative(JitContext& ctx) {
+    for (int i = 0; i < 8; ++i) ctx.regs[i] = registers[i];
+    ctx.counter = counter;
+    ctx.flag_eq = flag_eq; ctx.flag_gt = flag_gt; ctx.flag_lt = flag_lt;
+    ctx.callsBase = returns.base();
+    ctx.callsFull = ctx.callsBase + returns.capacity();
+    ctx.calls = ctx.callsBase + returns.size();
+
+    int next = jit->run(ctx, pc);
+
+    for (int i = 0; i < 8; ++i) registers[i] = ctx.regs[i];
+    counter = ctx.counter;
+    flag_eq = ctx.flag_eq; flag_gt = ctx.flag_gt; flag_lt = ctx.flag_lt;
+    returns.setSize(ctx.calls - ctx.callsBase);
+    executed += ctx.retired;
+    if (ctx.bailed) {
+        // the op has a native form but not for this state (a CALL with the
+        // return stack full, say): the interpreter runs it and reports it
+        pc = next;
+        interpret(program->ops, OPF_STEP);
+        next = pc;
     }
+    return next;
+}
 
-    else if (instr == "SETM") {
-    int addr, val;
-    iss >> addr >> val;
-    if (isValidAddr(addr)) {
-    memory[addr] = val;
-    std::cout << "[SETM] memory[" << addr << "] = " << val << std::endl;
-    } else {
-        std::cerr << "Invalid memory address in SETM: " << addr << std::endl;
-        std::exit(1);
-        }
+// Mixed-mode run: native code for every op the JIT compiled, the
+// interpreter (one op at a time) for the rest.
+void VirtualMachine::runJit() {
+    if (!jit) jit = std::make_unique<Jit>();
+    const std::vector<Op>& ops = program->ops;
+    if (!jit->compile(ops, !quiet, memory.flat() != nullptr)) {
+        std::cerr << "JIT unavailable, interpreting\n";
+        pc = 0;
+        interpret(program->fused, 0);
+        output().flush();
+        return;
     }
 
+    JitContext ctx{};
+    ctx.mem = memory.flat();
+    const int n = (int)ops.size() - 1;
 
-    else if (instr == "MEMDUMP") {
-    for (int i = 0; i < memory.size(); ++i) {
-        if (memory[i] != 0)
-            std::cout << "[" << i << "] = " << memory[i] << std::endl;
-        }
+    for (pc = 0; pc < n; ) {
+        if (jit->has(pc)) pc = runNative(ctx);
+        else interpret(ops, OPF_STEP);
     }
+    output().flush();
+}
 
-
-    else if (instr == "MOV") {
-    std::string regName;
-    int val;
-    iss >> regName >> val;
-    int regIndex = getRegisterIndex(regName);
-    if (regIndex >= 0 && regIndex < registers.size()) {
-        registers[regIndex] = val;
-    } else {
-        std::cerr << "Invalid register: " << regName << std::endl;
-        }
+// Tiered run. Every block starts in the plain interpreter (tier 0). Once
+// it has been entered tiers.fusedAfter times it runs from the fused stream
+// (tier 1), and after tiers.nativeAfter entries, if all of its ops have a
+// native form, it is compiled on its own (tier 2). The interpreter counts
+// block entries as it reaches leaders and only returns here when the next
+// block runs in another tier; native blocks jump directly into other
+// native blocks (see Jit::compileRange) and only come back when they
+// leave hot code, so entries from one native block into another are not
+// counted. Promotions are logged in tierLog.
+void VirtualMachine::runTiered() {
+    const std::vector<Op>& ops = program->ops;
+    const bool echo = !quiet;
+    const bool canJit = Jit::supported();
+    blocks.clear();
+    for (const Program::Block& pb : program->blocks) {
+        Block b;
+        b.start = pb.start;
+        b.end = pb.end;
+        b.native = canJit;
+        for (int i = b.start; i < b.end && b.native; ++i)
+            b.native = Jit::canCompile(ops[i], echo, memory.flat() != nullptr);
+        blocks.push_back(b);
     }
-
-
-    else if (instr == "LOADR") {
-        std::string regName;
-        iss >> regName;
-        int regIndex = getRegisterIndex(regName);
-        if (regIndex >= 0 && regIndex < registers.size()) {
-            stack.push_back(registers[regIndex]);
+    tierLog.clear();
+    jit = std::make_unique<Jit>();
+
+    JitContext ctx{};
+    ctx.mem = memory.flat();
+    const int n = (int)ops.size() - 1;
+
+    pc = 0;
+    if (n > 0) enterBlock(0, 0);
+    while (pc < n) {
+        const Block& b = blocks[program->blockOf[pc]];
+        // a fused op can step over a leader and resume mid-block; native
+        // blocks are entered wherever the JIT has an entry
+        if (b.tier == 2 && jit->has(pc)) {
+            pc = runNative(ctx);
+            if (pc < n) enterBlock(pc, 2);
         } else {
-            std::cerr << "Invalid register: " << regName << std::endl;
-        }
-    }
-
-
-    else if (instr == "STORER") {
-    std::string regName;
-    iss >> regName;
-    int regIndex = getRegisterIndex(regName);
-    if (regIndex >= 0 && regIndex < registers.size()) {
-        int value = stack.back(); stack.pop_back();
-        registers[regIndex] = value;
-    } else {
-        std::cerr << "Invalid register: " << regName << std::endl;
+            interpret(b.tier ? program->fused : ops, OPF_LEADER);
         }
     }
+    output().flush();
+}
 
-
-    else if (instr == "ADDR") {
-    std::string dest, src1, src2;
-    iss >> dest >> src1 >> src2;
-    int d = getRegisterIndex(dest);
-    int s1 = getRegisterIndex(src1);
-    int s2 = getRegisterIndex(src2);
-    if (d >= 0 && s1 >= 0 && s2 >= 0) {
-        registers[d] = registers[s1] + registers[s2];
-    } else {
-        std::cerr << "Invalid register in ADDR" << std::endl;
-        }
+// Counts an entry into the block starting at `leader`, promotes it if that
+// crossed a threshold, and returns true if it must run in a tier other
+// than `tier`.
+bool VirtualMachine::enterBlock(int leader, uint8_t tier) {
+    const int id = program->blockOf[leader];
+    Block& b = blocks[id];
+    ++b.entries;
+
+    auto promote = [&](uint8_t to) {
+        tierLog.push_back({id, b.tier, to, b.entries});
+        b.tier = to;
+    };
+    if (b.tier < 1 && b.entries >= tiers.fusedAfter) promote(1);
+    if (b.tier < 2 && b.native && b.entries >= tiers.nativeAfter) {
+        if (jit->compileRange(program->ops, !quiet, memory.flat() != nullptr, b.start, b.end)) promote(2);
+        else b.native = false;
     }
+    return b.tier != tier;
+}
 
-
-    else if (instr == "PRINTR") {
-    std::string regName;
-    iss >> regName;
-    int r = getRegisterIndex(regName);
-    if (r >= 0) {
-        std::cout << "[PRINTR] " << regName << " = " << registers[r] << std::endl;
-        }
+void VirtualMachine::printTierStats(std::ostream& os) const {
+    uint64_t entered = 0;
+    int native = 0;
+    for (const Block& b : blocks) {
+        entered += b.entries;
+        native += b.tier == 2;
     }
-
-
-    else if (instr == "LOADMR") {
-    std::string regName;
-    int addr;
-    iss >> regName >> addr;
-    int r = getRegisterIndex(regName);
-    if (r >= 0 && isValidAddr(addr)) {
-        registers[r] = memory[addr];
-        std::cout << "[LOADMR] " << regName << " = memory[" << addr << "] = " << memory[addr] << std::endl;
-    } else {
-        std::cerr << "Invalid LOADMR instruction." << std::endl;
-        }
+    os << "[TIER] " << blocks.size() << " blocks, " << entered << " block entries, "
+       << tierLog.size() << " promotions, " << native << " native block(s), "
+       << (jit ? jit->codeSize() : 0) << " bytes of native code\n";
+
+    std::vector<int> order;
+    for (int i = 0; i < (int)blocks.size(); ++i)
+        if (blocks[i].entries) order.push_back(i);
+    std::stable_sort(order.begin(), order.end(),
+                     [&](int x, int y) { return blocks[x].entries > blocks[y].entries; });
+    for (int i : order) {
+        const Block& b = blocks[i];
+        os << "[TIER] block " << i << " (lines " << b.start + 1 << "-" << b.end << "): "
+           << b.entries << " entries, tier " << int(b.tier) << "\n";
     }
+    for (const TierEvent& e : tierLog)
+        os << "[TIER] block " << e.block << " (line " << blocks[e.block].start + 1 << "): tier "
+           << int(e.from) << " -> " << int(e.to) << " after " << e.entries << " entries\n";
+}
 
-
-    else if (instr == "STOREMR") {
-    int addr;
-    std::string regName;
-    iss >> addr >> regName;
-    int r = getRegisterIndex(regName);
-    if (r >= 0 && isValidAddr(addr)) {
-        memory[addr] = registers[r];
-        std::cout << "[STOREMR] memory[" << addr << "] = " << registers[r] << std::endl;
-    } else {
-        std::cerr << "Invalid STOREM instruction." << std::endl;
+std::string VirtualMachine::diffState(const VirtualMachine& other) const {
+    std::ostringstream os;
+    for (size_t i = 0; i < registers.size(); ++i)
+        if (registers[i] != other.registers[i]) {
+            os << "R" << i << ": " << registers[i] << " vs " << other.registers[i];
+            return os.str();
         }
+    if (counter != other.counter) {
+        os << "COUNTER: " << counter << " vs " << other.counter;
+        return os.str();
     }
-
-
-    else if (instr == "CMP") {
-    std::string left, right;
-    iss >> left >> right;
-
-    int a, b;
-    if (left == "COUNTER") {
-        a = counter;
-    } else {
-        int i = getRegisterIndex(left);
-        if (i < 0) { std::cerr << "Invalid CMP reg: " << left << std::endl; return; }
-        a = registers[i];
+    if (flag_eq != other.flag_eq || flag_gt != other.flag_gt || flag_lt != other.flag_lt) {
+        os << "FLAGS: EQ=" << flag_eq << " GT=" << flag_gt << " LT=" << flag_lt
+           << " vs EQ=" << other.flag_eq << " GT=" << other.flag_gt << " LT=" << other.flag_lt;
+        return os.str();
     }
-
-    if (right == "COUNTER") {
-        b = counter;
-    } else {
-        int i = getRegisterIndex(right);
-        if (i < 0) { std::cerr << "Invalid CMP reg: " << right << std::endl; return; }
-        b = registers[i];
+    if (stack != other.stack) return "STACK differs";
+    if (returns != other.returns) return "RETURN STACK differs";
+    uint64_t at;
+    if (memory.firstDifference(other.memory, at)) {
+        os << "MEM[" << at << "]: " << memory.load(at) << " vs " << other.memory.load(at);
+        return os.str();
     }
-
-    flag_eq = (a == b);
-    flag_gt = (a > b);
-    flag_lt = (a < b);
-
-    std::cout << "[CMP] " << left << "(" << a << ") vs " << right << "(" << b << ") => "
-              << "EQ: " << flag_eq << ", GT: " << flag_gt << ", LT: " << flag_lt << std::endl;
-    }
-
-
-    else if (instr == "JEQ") {
-    int target;
-    iss >> target;
-    if (flag_eq) pc = target - 1;
-    }
-
-
-    else if (instr == "JNE") {
-    int target;
-    iss >> target;
-    if (!flag_eq) pc = target - 1;
+    if (executed != other.executed) {
+        os << "instructions retired: " << executed << " vs " << other.executed;
+        return os.str();
     }
+    return "";
+}
 
 
-    else if (instr == "JGT") {
-    int target;
-    iss >> target;
-    if (flag_gt) pc = target - 1;
+// Text mode has no loop of its own any more: the source is compiled to a
+// container once and loaded like any other program, so each line is parsed
+// once however many times it runs.
+bool VirtualMachine::loadProgram(const std::string& filename, std::string* error) {
+    std::string source, why;
+    std::vector<uint8_t> bytes;
+    bool ok = readSource(filename, source, why);
+    if (ok && !compileText(source, bytes, why)) {
+        why = filename + ": " + why;
+        ok = false;
     }
-
-
-    else if (instr == "JLT") {
-    int target;
-    iss >> target;
-    if (flag_lt) pc = target - 1;
+    if (!ok) {
+        if (error) *error = why;
+        else std::cerr << why << "\n";
+        return false;
     }
+    std::shared_ptr<const Program> p = Program::fromMemory(bytes.data(), bytes.size(), filename, error);
+    if (!p || !stackFits(*p, error)) return false;
+    setProgram(std::move(p));
+    return true;
+}
 
-
-
-
-
-//EVENTUALLY ADD UI !!!1!
-
-
-
+void VirtualMachine::run() {
+    runBytecode();
 }
 
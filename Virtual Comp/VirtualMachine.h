@@ -1,74 +1,309 @@
 #pragma once             // include this file once per compilation unit
 #include <vector>
 #include <string>
-#include <unordered_set>
+#include <string_view>
+#include <map>
 #include <fstream>
 #include <iostream>
 #include <sstream>
 #include <cstdint>
-#include <functional>
-#include <unordered_map>
+#include <memory>
+#include <deque>
+#include "OutputSink.h"
+#include "Ops.h"
+#include "Program.h"
+#include "Memory.h"
+#include "Stack.h"
+#include "AsmCache.h"
+#include "Jit.h"
+#include "Profile.h"
+#include "Trace.h"
 
 class VirtualMachine {
+public:
+    // Thresholds for tiered execution (see runTiered). A block moves to the
+    // fused interpreter once it has been entered `fusedAfter` times and to
+    // native code after `nativeAfter` entries.
+    struct TierConfig {
+        uint64_t fusedAfter = 2;
+        uint64_t nativeAfter = 1000;
+    };
+
+    // Hotness of one Program::Block during a tiered run.
+    struct Block {
+        int start = 0, end = 0;
+        uint64_t entries = 0;  // times control entered at `start` (tiered runs)
+        uint8_t tier = 0;      // 0 plain interpreter, 1 fused, 2 native
+        bool native = false;   // every op has a native form
+    };
+
+    // One promotion of a block during a tiered run.
+    struct TierEvent {
+        int block;
+        uint8_t from, to;
+        uint64_t entries;      // block entries when it was promoted
+    };
+
+    // Machine state saved by snapshot(). Memory pages are shared with the
+    // machine (and with anything restored or forked from the snapshot)
+    // until one side writes them.
+    struct Snapshot {
+        std::shared_ptr<const Program> program;
+        Memory memory;
+        std::vector<int> stack;  // bottom first
+        std::vector<int> returns;  // return addresses, outermost CALL first
+        std::vector<int> registers;
+        int counter = 0;
+        int pc = 0;
+        bool flag_eq = false, flag_gt = false, flag_lt = false;
+        uint64_t executed = 0;  // instructions retired when it was taken
+    };
+
+    // A register, COUNTER, memory cell or constant, as named in a
+    // breakpoint condition or a watchpoint (`R3`, `COUNTER`, `MEM[20]`, `7`).
+    struct DebugValue {
+        enum Kind : uint8_t { CONST, REG, COUNTER, MEM } kind = CONST;
+        int32_t n = 0;  // the constant, register or address
+    };
+
+    // Stops the stepper before its line runs, if its condition holds (when
+    // it has one), from the `from`th time that happens on.
+    struct Breakpoint {
+        bool conditional = false;
+        DebugValue lhs, rhs;
+        std::string cmp;     // == != < <= > >=
+        uint64_t from = 1;
+        uint64_t hits = 0;   // times reached with the condition true
+    };
+
 private:
     // --- machine state ---
-    std::vector<std::string> instructions;
-    std::vector<int> stack;
+    OperandStack stack;
+    size_t stackDepth = VM_STACK_DEPTH;  // configured capacity
+    OperandStack returns{VM_CALL_DEPTH};  // CALL return addresses (op indices), apart from `stack`
+    bool faulted = false;  // the last run stopped on a stack or call overflow, a stray RET or a division by zero
     int counter = 0;
     int pc = 0;
-    std::vector<int> memory;
-    std::vector<int> registers = std::vector<int>(8, 0);  // R0–R7
+    Memory memory;
+    uint64_t memoryCells;  // configured size; a program may ask for more
+    std::vector<int> registers = std::vector<int>(VM_REGISTERS, 0);  // R0–R7
     bool flag_eq = false, flag_gt = false, flag_lt = false;
 
-    struct Instruction {
-        uint8_t opcode;
-        uint8_t a, b, c;
-    };
+    using Instruction = Program::Instruction;
+
+    // the decoded program, shared with every other machine running it
+    std::shared_ptr<const Program> program;
+    uint64_t executed = 0;  // instructions retired by the last runBytecode()
 
-    std::vector<Instruction> bytecode;
-    std::unordered_map<uint8_t, std::function<void(const Instruction&)>> dispatch;
+    // program output (PRINT/PRINTR/CPRINT and the CMP/memory echo)
+    std::unique_ptr<BufferedSink> stdoutSink;  // default: buffered std::cout, made on first use
+    OutputSink* out = nullptr;
+    bool quiet = false;  // drop the CMP/memory echo, keep real output
+
+    // optional native tier (see Jit.h)
+    bool useJit = false;
+    std::unique_ptr<Jit> jit;
+
+    // tiered execution: per-block hotness decides interpreter vs native
+    bool tiered = false;
+    TierConfig tiers;
+    std::vector<Block> blocks;        // per Program::Block, filled by runTiered()
+    std::vector<TierEvent> tierLog;
+
+    // profiling and binary tracing (see runInstrumented)
+    bool profiling = false;
+    std::unique_ptr<Profile> profile;  // from the last profiled run
+    TraceWriter* tracer = nullptr;     // not owned
 
     // stepper/trace
     bool trace = false;
     bool explain = false;
-    std::unordered_set<int> breakpoints; // 1-based PCs
+
+    // stepper debug points: breakpoints (see Breakpoint) and watchpoints,
+    // which stop after a line changes a register, COUNTER or memory cell.
+    // They are compiled into debugOps, a copy of the program's ops with
+    // OPF_BREAK on every breakpoint line and OPF_WATCH on every line that
+    // can write a watched location (addresses are static, so that set is
+    // exact). Stepping tests only those flags; nothing else is looked up
+    // until a flagged line comes up, and with no debug points nothing is.
+    std::map<int, Breakpoint> breakpoints;  // by 1-based line
+    std::vector<DebugValue> watches;
+    std::vector<Op> debugOps;               // empty while there are none
+
+    // stepper history (rstep/rcont/goto): what each of the last
+    // historyLimit stepped instructions overwrote, in a ring, plus
+    // checkpoints to replay from when going back further than that
+    enum UndoKind : uint8_t {
+        UNDO_NONE,      // only pc and flags
+        UNDO_REG, UNDO_COUNTER, UNDO_MEM,
+        UNDO_PUSH,      // pushed one value
+        UNDO_POP_REG,   // popped `popped` into a register
+        UNDO_POP_MEM,   // popped `popped` into a memory cell
+        UNDO_POP,       // popped `popped` and dropped it
+        UNDO_BINARY,    // replaced `old` and `popped` (the top) with their result
+        UNDO_CELLS,     // a block op wrote cells from `index`; they were saved in undoCells
+        UNDO_CALL,      // pushed a return address
+        UNDO_RET,       // popped return address `old`
+    };
+    struct UndoRecord {
+        int32_t pc;     // the instruction's pc
+        uint8_t kind;   // UndoKind
+        uint8_t flags;  // EQ | GT << 1 | LT << 2 before it
+        int32_t index;  // register or address written
+        int32_t old;    // its previous value
+        int32_t popped;
+    };
+    size_t historyLimit = size_t(1) << 20;
+    std::vector<UndoRecord> undoRing;
+    size_t undoHead = 0, undoSize = 0;  // next slot; records held
+    std::deque<std::vector<int32_t>> undoCells;  // per UNDO_CELLS record held, oldest first
+    std::vector<Snapshot> checkpoints;  // in instruction-count order
+    uint64_t checkpointEvery = 0, nextCheckpoint = 0;
+    uint64_t runLimit = UINT64_MAX;     // stoppable interpreter runs return after this many
 
 public:
-    VirtualMachine();
+    // A machine holds only its own state; creating one for an already
+    // loaded Program costs its registers and memory and nothing else.
+    explicit VirtualMachine(std::shared_ptr<const Program> program = nullptr,
+                            uint64_t memoryCells = VM_MEMORY_CELLS);
 
-    // text-mode (legacy) loader/runner — still declared because .cpp has them
-    void loadProgram(const std::string& filename);
+    // text-mode programs: compiled once (see compileText) into the same
+    // decoded form as bytecode, then run by runBytecode(). false if the
+    // file is unreadable or doesn't compile; the reason goes to *error, or
+    // to std::cerr when error is null
+    bool loadProgram(const std::string& filename, std::string* error = nullptr);
     void run();
 
     // bytecode path
-    void loadBytecode(const std::string& filename);
-    void initializeDispatchTable();
-    void runBytecode();             // fast path
+    // false if unreadable or invalid; the reason goes to *error, or to
+    // std::cerr when error is null
+    bool loadBytecode(const std::string& filename, std::string* error = nullptr);
+    // assembles `source` in-process; with a cache, identical source is
+    // assembled and decoded only once
+    bool loadSource(std::string_view source, std::string* error = nullptr, AssemblyCache* cache = nullptr);
+    void setProgram(std::shared_ptr<const Program> p);
+    const std::shared_ptr<const Program>& loadedProgram() const { return program; }
+    void runBytecode();             // fast path (threaded or switch dispatch)
     void runBytecodeStep();         // REPL/stepper
-    void disassemble() const;       // dump bytecode as text
+    // dump bytecode as text; with a profile, each line shows its hit count
+    void disassemble(std::ostream& os = std::cout, const Profile* hits = nullptr) const;
+
+    // output
+    void setOutput(OutputSink* sink);  // not owned; nullptr = buffered std::cout
+    void setQuiet(bool on) { quiet = on; }
+
+    // input: copies `cells` into memory from address 0; false if too many
+    bool setMemory(const std::vector<int>& cells);
+
+    // memory size in cells, grown to what the program declares if that is
+    // more; up to Memory::FLAT_LIMIT it is one flat array, above it pages
+    // are allocated as they are written
+    void setMemorySize(uint64_t cells);
+    uint64_t memorySize() const { return memory.size(); }
+
+    // operand stack capacity; a push past it ends the program with an error,
+    // and a program with a proven block that needs more (Program::proveStack)
+    // is refused before it runs
+    void setStackDepth(size_t values);
+    size_t stackCapacity() const { return stack.capacity(); }
+
+    // Saves registers, counter, flags, pc, both stacks and memory. Taking one
+    // copies no memory pages, but switches a flat memory of more than a page
+    // to pages (Memory::snapshot), which the JIT cannot compile memory ops
+    // against. restore() puts a memory within Memory::FLAT_LIMIT back in one
+    // flat array, copying the snapshot's cells, and so does the start of a
+    // run; larger memories just share the snapshot's pages again. restore()
+    // also switches back to the snapshot's program if another one was
+    // loaded since.
+    Snapshot snapshot();
+    void restore(const Snapshot& s);
+    // A new machine in this one's current state and with its settings
+    // (output, echo, tiers, trace, breakpoints), sharing unchanged pages.
+    VirtualMachine fork();
+
+    // execution tier
+    void setJit(bool on) { useJit = on; }
+    void setTiered(bool on) { tiered = on; }
+    void setTierConfig(const TierConfig& config) { tiers = config; }
+
+    // block entry counts and promotions from the last tiered run
+    const std::vector<Block>& blockStats() const { return blocks; }
+    const std::vector<TierEvent>& tierEvents() const { return tierLog; }
+    void printTierStats(std::ostream& os) const;
+
+    // Profiled runs count every line and jump on the plain interpreter
+    // (JIT and tiering are off) and sample time per opcode class.
+    void setProfiling(bool on) { profiling = on; }
+    const Profile* profileData() const { return profile.get(); }  // null until a profiled run
+
+    // Traced runs write one TraceRecord per instruction to `writer` (open,
+    // not owned; nullptr stops tracing), on the plain interpreter like
+    // profiled runs.
+    void setTracer(TraceWriter* writer) { tracer = writer; }
+
+    // Describes the first difference in registers, counter, flags, stacks or
+    // memory (over the addresses both have) between two machines; empty if
+    // they match.
+    std::string diffState(const VirtualMachine& other) const;
 
     // stepper controls
     void setTrace(bool on)   { trace = on; }
     void setExplain(bool on) { explain = on; }
+    void setHistorySize(size_t records) { historyLimit = records; }  // 0: checkpoints only
     void addBreakpoint(int one_based_pc);
+    void addBreakpoint(int one_based_pc, const Breakpoint& bp);
     void setBreakpoints(const std::vector<int>& bps);
+    // false (and nothing added) if the location is out of range
+    bool addWatch(const DebugValue& what);
+    // reads `R3`, `COUNTER`, `MEM[20]` (or `mem 20`) or an integer; false
+    // if the next token is none of these
+    static bool parseDebugValue(std::istream& in, DebugValue& v);
+    static std::string describe(const DebugValue& v);
     void printHelp() const;
 
+    uint64_t instructionCount() const { return executed; }
+    // the last run ended early on a stack or call overflow, a RET with no
+    // CALL, or a DIVR/MODR by zero
+    bool runFaulted() const { return faulted; }
+
+    // threaded-code label per DecodedOpcodes entry, for Program::load();
+    // null in switch-dispatch builds
+    static const void* const* handlerTable();
+
 private:
-    // text-mode executor
-    void execute(const std::string& instrLine);
+    // interpreter core
+    OutputSink& output();
+    const void* const* interpret(const std::vector<Op>& code, uint8_t stop, bool exportLabels = false);
+    enum : int { HOOK_PROFILE = 1, HOOK_TRACE = 2 };  // interpretCore instrumentation
+    template <bool Stoppable, bool Paged, int Hooks>
+    const void* const* interpretCore(const std::vector<Op>& code, uint8_t stop, bool exportLabels);
+    bool enterBlock(int leader, uint8_t tier);
+    int runNative(JitContext& ctx);
+    void runJit();
+    void runTiered();
+    void runInstrumented();
 
-    // helpers
-    bool isValidAddr(int addr) const;
+    // stepper history
+    void clearHistory();
+    void checkpoint();                    // a snapshot, if one is due
+    void recordStep();                    // before the op at pc runs
+    bool stepBack();                      // false at instruction 0
+    void travelTo(uint64_t count);        // state after `count` instructions (or the end)
+    void replayTo(uint64_t count, uint64_t* lastBreak = nullptr);
+    bool reverseToBreakpoint();
+    void continueFast();                  // cont, to the next debug point
 
-    int getRegisterIndex(const std::string& token) {
-        if (token.size() != 2 || token[0] != 'R') return -1;
-        return token[1] - '0';  // R0–R7
-    }
+    // debug points
+    void compileDebugPoints();            // rebuilds debugOps
+    int32_t debugValue(const DebugValue& v) const;
+    bool breakHere(bool countHit);        // a breakpoint stops before pc
+
+    // helpers
+    void loadData();                                  // program's data section -> memory
+    bool stackFits(const Program& p, std::string* error) const;  // every proven block fits the capacity
 
     void printState() const;                          // regs/stack/mem/flags
     void printInstruction(const Instruction&) const;  // pretty instruction
-    const char* opcodeName(uint8_t op) const;         // mnemonic
     void dumpRegs() const;
     void dumpStack() const;
     void dumpMem(int start, int len) const;
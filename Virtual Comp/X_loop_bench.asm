@@ -0,0 +1,25 @@
+; Loop benchmark: a counted ADDR/CMP/JLT loop, ~1M iterations
+; Builds the bound with repeated doubling since MOV only takes 0-255.
+
+MOV R1 250
+ADDR R1 R1 R1     ; 500
+ADDR R1 R1 R1     ; 1000
+ADDR R1 R1 R1     ; 2000
+ADDR R1 R1 R1     ; 4000
+ADDR R1 R1 R1     ; 8000
+ADDR R1 R1 R1     ; 16000
+ADDR R1 R1 R1     ; 32000
+ADDR R1 R1 R1     ; 64000
+ADDR R1 R1 R1     ; 128000
+ADDR R1 R1 R1     ; 256000
+ADDR R1 R1 R1     ; 512000
+ADDR R1 R1 R1     ; 1024000
+MOV R2 1
+top: MOV R0 0     ; a jump to 'top' resumes on the next line
+DECR
+ADDR R0 R0 R2
+CMP R0 R1
+JLT top
+PRINTR R0         ; expect: [PRINTR] R0 = 1024000
+CPRINT            ; expect: [CPRINT] counter = -1024000
+CEASE
@@ -1,37 +1,388 @@
 #include <iostream>
+#include <chrono>
+#include <algorithm>
+#include <cctype>
+#include <thread>
 #include "VirtualMachine.h"
+#include "Batch.h"
+#include "Bench.h"
+#include "Golden.h"
+#include "Asm.h"
+#include "AsmCache.h"
+#include "Trace.h"
+#include "Vector.h"
+
+// Execution settings shared by --run and --bench.
+struct RunOptions {
+    bool quiet = false, jit = false, tiered = false;
+    bool inlineCalls = false;  // load through Program::inlineCalls (--inline)
+    VirtualMachine::TierConfig tiers;
+    uint64_t memoryCells = 0;  // 0: the default, or what the program declares
+    size_t stackDepth = 0;     // 0: the default
+
+    void apply(VirtualMachine& vm) const {
+        if (memoryCells) vm.setMemorySize(memoryCells);
+        if (stackDepth) vm.setStackDepth(stackDepth);
+        vm.setQuiet(quiet);
+        vm.setJit(jit);
+        vm.setTiered(tiered);
+        vm.setTierConfig(tiers);
+    }
+};
+
+// Loads a bytecode file, or assembles it in-process (through `cache`) if it
+// is assembly source; with `inlineCalls`, small leaf subroutines are then
+// inlined at their CALLs.
+static std::shared_ptr<const Program> loadProgram(const std::string& file, AssemblyCache& cache,
+                                                  bool inlineCalls = false) {
+    std::shared_ptr<const Program> program;
+    if (!isAssemblySource(file)) {
+        program = Program::load(file);
+    } else {
+        std::string source, error;
+        if (!readSource(file, source, error)) {
+            std::cerr << error << "\n";
+            return nullptr;
+        }
+        program = cache.get(source, file);
+    }
+    return program && inlineCalls ? Program::inlineCalls(program) : program;
+}
+
+// Loads the program once and reports how long that took, then runs it
+// `reps` times on fresh machines and reports throughput. Program output
+// goes to a NullSink so only execution is measured.
+static void bench(const std::string& file, int reps, const RunOptions& opts, AssemblyCache& cache) {
+    uint64_t total = 0;
+    double seconds = 0;
+    NullSink sink;
+
+    auto l0 = std::chrono::steady_clock::now();
+    std::shared_ptr<const Program> program = loadProgram(file, cache, opts.inlineCalls);
+    auto l1 = std::chrono::steady_clock::now();
+    if (!program) return;
+    std::cout << "[LOAD] " << file << ": " << program->size() << " instructions ("
+              << program->fileSize() / double(1 << 20) << " MiB, "
+              << (program->mapped() ? "mapped" : program->version ? "read" : "legacy, widened") << ") in "
+              << std::chrono::duration<double, std::milli>(l1 - l0).count() << " ms\n";
+    if (isAssemblySource(file)) {
+        // a second submission of the same source is served from the cache
+        auto c0 = std::chrono::steady_clock::now();
+        loadProgram(file, cache);
+        auto c1 = std::chrono::steady_clock::now();
+        std::cout << "[LOAD] " << file << ": again, through the cache, in "
+                  << std::chrono::duration<double, std::milli>(c1 - c0).count() << " ms\n";
+    }
+    for (int r = 0; r < reps; ++r) {
+        VirtualMachine vm(program);
+        vm.setOutput(&sink);
+        opts.apply(vm);
+        auto t0 = std::chrono::steady_clock::now();
+        vm.runBytecode();
+        auto t1 = std::chrono::steady_clock::now();
+        seconds += std::chrono::duration<double>(t1 - t0).count();
+        total += vm.instructionCount();
+    }
+    std::cout << "[BENCH] " << file << ": " << total << " instructions in "
+              << seconds * 1000.0 << " ms over " << reps << " run(s) => "
+              << (seconds > 0 ? total / seconds / 1e6 : 0.0) << " M instr/s\n";
+}
+
+// Differential check: runs the program on the interpreter, on the JIT,
+// tiered (with thresholds low enough to reach every tier), tiered with
+// paged rather than flat memory, once more on a fork of a machine that
+// has run the program and been restored to a snapshot taken before it,
+// on the interpreter with the scalar block-op kernels, and on the
+// interpreter with calls inlined, with and without the CMP/memory echo,
+// and compares output and final machine state. Returns false on any
+// mismatch.
+static bool compare(const std::string& file, AssemblyCache& cache) {
+    std::shared_ptr<const Program> program = loadProgram(file, cache);
+    if (!program) return false;
+    std::shared_ptr<const Program> inlined = Program::inlineCalls(program);
+    bool ok = true;
+    for (bool quiet : {false, true}) {
+        RingBufferSink interpOut(1 << 20);
+        VirtualMachine interp(program);
+        interp.setOutput(&interpOut);
+        interp.setQuiet(quiet);
+        interp.runBytecode();
+
+        for (const char* engine : {"jit", "tiered", "paged", "restored", "scalar", "inlined"}) {
+            RingBufferSink otherOut(1 << 20);
+            VirtualMachine other(engine[0] == 'i' ? inlined : program);
+            other.setOutput(&otherOut);
+            other.setQuiet(quiet);
+            if (engine[0] == 'j') {
+                other.setJit(true);
+            } else if (engine[0] == 'r') {
+                NullSink scratch;
+                VirtualMachine base(program, 4 * Memory::PAGE_CELLS);  // big enough that snapshot() pages it
+                base.setOutput(&scratch);
+                base.setQuiet(quiet);
+                VirtualMachine::Snapshot start = base.snapshot();
+                base.runBytecode();
+                base.restore(start);
+                base.setOutput(&otherOut);
+                other = base.fork();
+            } else if (engine[0] == 's' || engine[0] == 'i') {
+                // the kernels are picked around the run, below; the
+                // inlined program runs as it is
+            } else {
+                other.setTiered(true);
+                other.setTierConfig({1, 2});
+                if (engine[0] == 'p') other.setMemorySize(Memory::FLAT_LIMIT + 1);
+            }
+            const std::string kernels = vectorKernels().name;
+            if (engine[0] == 's') selectVectorKernels("scalar");
+            other.runBytecode();
+            selectVectorKernels(kernels);
+
+            std::string why = interp.diffState(other);
+            if (engine[0] == 'i' && why.compare(0, 20, "instructions retired") == 0)
+                why.clear();  // an inlined call retires no CALL or RET
+            if (why.empty() && interpOut.str() != otherOut.str()) why = "program output differs";
+            std::cout << (why.empty() ? "PASS " : "FAIL ") << file << " (" << engine
+                      << (quiet ? ", quiet" : "") << ")" << (why.empty() ? "" : ": " + why) << "\n";
+            ok = ok && why.empty();
+        }
+    }
+    return ok;
+}
+
+// Runs every job in the manifest across `threads` workers and prints each
+// job's output, in manifest order, under a header line. Returns false if
+// the manifest is unreadable or any job failed.
+static bool batch(const std::string& manifest, int threads, const RunOptions& opts, AssemblyCache& cache) {
+    std::vector<BatchJob> jobs;
+    std::string error;
+    if (!readManifest(manifest, jobs, error)) {
+        std::cerr << error << "\n";
+        return false;
+    }
+
+    int failed = 0;
+    uint64_t total = 0;
+    auto t0 = std::chrono::steady_clock::now();
+    runBatch(jobs, threads,
+        [&](VirtualMachine& vm) { opts.apply(vm); },
+        [&](size_t i, const BatchResult& r) {
+            const BatchJob& job = jobs[i];
+            std::cout << "=== [" << (i + 1) << "] " << job.program
+                      << (job.memoryImage.empty() ? "" : " " + job.memoryImage);
+            if (!r.ok) {
+                std::cout << ": FAILED: " << r.error << "\n";
+                ++failed;
+                return;
+            }
+            std::cout << "\n" << r.output;
+            total += r.instructions;
+        },
+        &cache);
+    auto t1 = std::chrono::steady_clock::now();
+    std::cout.flush();
+
+    std::cerr << "[BATCH] " << jobs.size() << " job(s), " << failed << " failed, "
+              << total << " instructions in "
+              << std::chrono::duration<double, std::milli>(t1 - t0).count()
+              << " ms on " << threads << " thread(s)\n";
+    return failed == 0;
+}
+
+// Which records --trace-dump prints: lines [fromLine, toLine] (1-based;
+// 0 for no bound) and, if any are named, only those opcodes.
+struct TraceFilter {
+    int fromLine = 0, toLine = 0;
+    std::vector<std::string> opcodes;
+
+    bool keep(const TraceRecord& r) const {
+        if (fromLine && r.pc + 1 < fromLine) return false;
+        if (toLine && r.pc + 1 > toLine) return false;
+        if (opcodes.empty()) return true;
+        return std::find(opcodes.begin(), opcodes.end(), Program::opcodeName(r.opcode)) != opcodes.end();
+    }
+};
+
+// Decodes a --trace-file trace and prints the records the filter keeps.
+static bool traceDump(const std::string& file, const TraceFilter& filter, bool explain) {
+    TraceReader reader;
+    std::string error;
+    if (!reader.open(file, error)) {
+        std::cerr << error << "\n";
+        return false;
+    }
+    TraceRecord r;
+    uint64_t n = 0, shown = 0;
+    while (reader.next(r)) {
+        ++n;
+        if (!filter.keep(r)) continue;
+        printTraceRecord(std::cout, n, r, explain);
+        ++shown;
+    }
+    std::cout.flush();
+    std::cerr << "[TRACE] " << shown << " of " << n << " records (" << reader.header().lines
+              << "-line program)\n";
+    return true;
+}
 
 int main(int argc, char** argv) {
     if (argc < 3) {
         std::cout <<
 "Usage:\n"
-"  vm --run    program.bin [--trace] [--explain] [--bp N ...]\n"
-"  vm --step   program.bin [--trace] [--explain] [--bp N ...]\n"
-"  vm --disasm program.bin\n";
+"  vm --run    program.bin [--quiet] [--jit | --tiered [--tier1 N] [--tier2 N] [--tier-stats]]\n"
+"                           [--memory CELLS] [--stack VALUES] [--profile [--profile-json FILE]]\n"
+"                           [--trace-file FILE] [--trace] [--explain] [--bp N ...] [--simd NAME]\n"
+"                           [--inline]\n"
+"  vm --step   program.bin [--trace] [--explain] [--bp N ...] [--history N] [--inline]\n"
+"  vm --disasm program.bin [--text] [--inline]\n"
+"  vm --bench  program.bin [--reps N] [--quiet] [--jit | --tiered [--tier1 N] [--tier2 N]] [--inline]\n"
+"  vm --compare program.bin ...   (JIT, tiered, paged memory, restored\n"
+"                                  snapshot, scalar kernels and inlined\n"
+"                                  calls vs interpreter)\n"
+"  vm --batch  manifest.txt [-j N] [--quiet] [--jit | --tiered ...]\n"
+"  vm --trace-dump trace.vmtr [--pc FROM-TO] [--op NAME ...] [--explain]\n"
+"  vm --bench-suite all|counter|arith|alu|memory|stack|branch|call|vector [--reps N] [--instructions N]\n"
+"  vm --golden expectations.ex.txt\n"
+"program.bin may be - to read the program from stdin, or a .asm file to\n"
+"assemble in-process; --cache DIR keeps assembled programs on disk and\n"
+"--cache-stats reports cache hits and misses. --profile counts every line\n"
+"and branch, prints a report and an annotated listing after the run, and\n"
+"--profile-json also writes the counts as JSON. --trace-file records every\n"
+"instruction and what it changed, in binary; --trace-dump decodes it.\n"
+"--text reads program.bin as a text-mode program (HOP, HZ, SETM, ...) and\n"
+"compiles it for --run, --step or --disasm. --simd avx2|sse2|scalar picks\n"
+"the kernels for the block ops (VADD, VSUM, ...) instead of the best the\n"
+"CPU has. --inline replaces each CALL of a small leaf subroutine with its\n"
+"body when the program loads.\n";
         return 0;
     }
 
     std::string mode = argv[1];
     std::string file = argv[2];
 
-    VirtualMachine vm;
+    if (mode == "--golden") return runGolden(std::cout, file) ? 0 : 1;
+
+    if (mode == "--compare") {
+        AssemblyCache cache;
+        bool ok = true;
+        for (int i = 2; i < argc; ++i) ok = compare(argv[i], cache) && ok;
+        return ok ? 0 : 1;
+    }
 
+    bool trace = false, explain = false, tierStats = false, cacheStats = false, profile = false, text = false;
+    std::string cacheDir, profileJson, traceFile;
+    TraceFilter traceFilter;
+    RunOptions opts;
     std::vector<int> bps;
+    int reps = 1;
+    uint64_t suiteInstructions = 20000000;  // per --bench-suite kernel
+    size_t history = size_t(1) << 20;  // undo records kept by the stepper
+    int threads = std::max(1u, std::thread::hardware_concurrency());
     for (int i = 3; i < argc; ++i) {
         std::string flag = argv[i];
-        if (flag == "--trace") vm.setTrace(true);
-        else if (flag == "--explain") vm.setExplain(true);
+        if (flag == "--trace") trace = true;
+        else if (flag == "--quiet") opts.quiet = true;
+        else if (flag == "--jit") opts.jit = true;
+        else if (flag == "--tiered") opts.tiered = true;
+        else if (flag == "--inline") opts.inlineCalls = true;
+        else if (flag == "--tier-stats") tierStats = true;
+        else if (flag == "--tier1" && i+1 < argc) opts.tiers.fusedAfter = std::stoull(argv[++i]);
+        else if (flag == "--tier2" && i+1 < argc) opts.tiers.nativeAfter = std::stoull(argv[++i]);
+        else if (flag == "--explain") explain = true;
         else if (flag == "--bp" && i+1 < argc) {
             int n = std::stoi(argv[++i]);
             bps.push_back(n);
         }
+        else if (flag == "--reps" && i+1 < argc) reps = std::stoi(argv[++i]);
+        else if (flag == "--instructions" && i+1 < argc) suiteInstructions = std::stoull(argv[++i]);
+        else if ((flag == "-j" || flag == "--jobs") && i+1 < argc) threads = std::max(1, std::stoi(argv[++i]));
+        else if (flag == "--cache" && i+1 < argc) cacheDir = argv[++i];
+        else if (flag == "--cache-stats") cacheStats = true;
+        else if (flag == "--memory" && i+1 < argc) opts.memoryCells = std::stoull(argv[++i]);
+        else if (flag == "--stack" && i+1 < argc) opts.stackDepth = std::stoull(argv[++i]);
+        else if (flag == "--history" && i+1 < argc) history = std::stoull(argv[++i]);
+        else if (flag == "--profile") profile = true;
+        else if (flag == "--text") text = true;
+        else if (flag == "--simd" && i+1 < argc) {
+            std::string name = argv[++i];
+            if (!selectVectorKernels(name)) {
+                std::cerr << "--simd " << name << ": not available on this CPU or build\n";
+                return 1;
+            }
+        }
+        else if (flag == "--profile-json" && i+1 < argc) { profile = true; profileJson = argv[++i]; }
+        else if (flag == "--trace-file" && i+1 < argc) traceFile = argv[++i];
+        else if (flag == "--pc" && i+1 < argc) {
+            std::string range = argv[++i];
+            size_t dash = range.find('-');
+            traceFilter.fromLine = std::stoi(range.substr(0, dash));
+            traceFilter.toLine = dash == std::string::npos ? traceFilter.fromLine
+                               : dash + 1 < range.size() ? std::stoi(range.substr(dash + 1)) : 0;
+        }
+        else if (flag == "--op" && i+1 < argc) {
+            std::string name = argv[++i];
+            for (char& ch : name) ch = char(std::toupper((unsigned char)ch));
+            traceFilter.opcodes.push_back(name);
+        }
     }
+
+    if (mode == "--trace-dump") return traceDump(file, traceFilter, explain) ? 0 : 1;
+    if (mode == "--bench-suite") return runBenchSuite(std::cout, file, reps, suiteInstructions) ? 0 : 1;
+
+    AssemblyCache cache(cacheDir);
+    if (mode == "--bench") {
+        bench(file, reps, opts, cache);
+        if (cacheStats) cache.printStats(std::cout);
+        return 0;
+    }
+    if (mode == "--batch") {
+        bool ok = batch(file, threads, opts, cache);
+        if (cacheStats) cache.printStats(std::cerr);
+        return ok ? 0 : 1;
+    }
+
+    VirtualMachine vm;
+    vm.setTrace(trace);
+    vm.setExplain(explain);
+    opts.apply(vm);
     vm.setBreakpoints(bps);
+    vm.setHistorySize(history);
+    vm.setProfiling(profile);
 
-    vm.loadBytecode(file);
+    if (text) {
+        if (!vm.loadProgram(file)) return 1;
+    } else {
+        std::shared_ptr<const Program> program = loadProgram(file, cache, opts.inlineCalls);
+        if (!program) return 1;
+        vm.setProgram(std::move(program));
+    }
 
     if (mode == "--run") {
+        TraceWriter tracer;
+        if (!traceFile.empty()) {
+            std::string error;
+            if (!tracer.open(traceFile, vm.loadedProgram()->size(), error)) {
+                std::cerr << error << "\n";
+                return 1;
+            }
+            vm.setTracer(&tracer);
+        }
         vm.runBytecode();
+        if (!traceFile.empty()) {
+            vm.setTracer(nullptr);
+            if (!tracer.close()) std::cerr << "error writing " << traceFile << "\n";
+            std::cerr << "[TRACE] " << tracer.records() << " records written to " << traceFile << "\n";
+        }
+        if (tierStats) vm.printTierStats(std::cout);
+        if (const Profile* p = vm.profileData()) {
+            p->report(std::cout, *vm.loadedProgram());
+            vm.disassemble(std::cout, p);
+            if (!profileJson.empty()) {
+                std::ofstream json(profileJson);
+                p->writeJson(json, *vm.loadedProgram(), file);
+                if (!json) std::cerr << "cannot write " << profileJson << "\n";
+            }
+        }
     } else if (mode == "--step") {
         vm.runBytecodeStep();
     } else if (mode == "--disasm") {
@@ -39,5 +390,6 @@ int main(int argc, char** argv) {
     } else {
         std::cerr << "Unknown mode: " << mode << "\n";
     }
-    return 0;
+    if (cacheStats) cache.printStats(std::cerr);
+    return vm.runFaulted() ? 1 : 0;
 }